@@ -0,0 +1,136 @@
+#include <stcp/config.h>
+#include <stcp/tuning.h>
+#include <stcp/arch/dpdk/rte.h>
+#include <queue>
+
+using namespace stcp;
+
+
+/*
+ * Microbenchmark of the ifnet tx queue, std::queue as it
+ * was before mbuf_ring against mbuf_ring. Each pass moves
+ * one burst in and out the way ifnet::io_rx()/io_tx() did:
+ *
+ *   old:  push() per mbuf, then front()/pop() per mbuf
+ *   ring: push_bulk(), then pop_bulk()
+ *
+ * First on dummy pointers (the container alone), then between
+ * rx and tx of port 0 if the EAL has one, e.g. --vdev=eth_null0.
+ * See doc/perfotmance/pkt_queue.md.
+ */
+static const size_t   burst       = ST_BURST_SIZE;
+static const size_t   loop_passes = 10000000;
+static const uint64_t null_secs   = 10;
+
+
+struct old_path {
+    std::queue<mbuf*> q;
+
+    void in(mbuf** bufs, size_t n)
+    {
+        for (size_t i=0; i<n; i++)
+            q.push(bufs[i]);
+    }
+    size_t out(mbuf** bufs, size_t n)
+    {
+        size_t i;
+        for (i=0; i<n && !q.empty(); i++) {
+            bufs[i] = q.front();
+            q.pop();
+        }
+        return i;
+    }
+};
+
+struct ring_path {
+    mbuf_ring<ST_PKTQUEUE_SIZE> q;
+
+    void in(mbuf** bufs, size_t n)
+    {
+        size_t moved = q.push_bulk(bufs, n);
+        for (size_t i=moved; i<n; i++)
+            rte::pktmbuf_free(bufs[i]); /* never with one burst queued */
+    }
+    size_t out(mbuf** bufs, size_t n) { return q.pop_bulk(bufs, n); }
+};
+
+
+template <class P>
+static void bench_loop(const char* name)
+{
+    P p;
+    mbuf* bufs[burst];
+    for (size_t i=0; i<burst; i++)
+        bufs[i] = reinterpret_cast<mbuf*>(i + 1);
+
+    uint64_t start = rte::get_tsc_cycles();
+    for (size_t n=0; n<loop_passes; n++) {
+        p.in(bufs, burst);
+        p.out(bufs, burst);
+    }
+    uint64_t cycles = rte::get_tsc_cycles() - start;
+
+    double mbufs = double(loop_passes) * burst;
+    printf("%-5s loop     %8.2f Mmbufs/s %6.2f cycles/mbuf\n", name,
+            mbufs * rte::get_tsc_hz() / cycles / 1e6, cycles / mbufs);
+}
+
+
+/*
+ * rx burst -> queue -> tx burst on port 0, as one
+ * lcore polling it. Reports the mbufs sent per second.
+ */
+template <class P>
+static void bench_null(const char* name)
+{
+    P p;
+    mbuf* bufs[burst];
+    uint64_t nb_tx = 0;
+    uint64_t hz    = rte::get_tsc_hz();
+    uint64_t start = rte::get_tsc_cycles();
+    uint64_t end   = start + null_secs * hz;
+
+    for (uint64_t now=start; now<end; now=rte::get_tsc_cycles()) {
+        uint16_t num_rx = rte::eth_rx_burst(0, 0, bufs, burst);
+        p.in(bufs, num_rx);
+
+        size_t num = p.out(bufs, burst);
+        uint16_t num_tx = rte::eth_tx_burst(0, 0, bufs, num);
+        for (size_t i=num_tx; i<num; i++)
+            rte::pktmbuf_free(bufs[i]);
+        nb_tx += num_tx;
+    }
+    printf("%-5s port0    %8.2f Mpps\n", name, double(nb_tx) / null_secs / 1e6);
+}
+
+
+static void port_setup()
+{
+    mempool* mp = rte::pktmbuf_pool_create("Bench Pool", 8192,
+            ST_DATAPLANE_MP_CACHESIZ, 0, ST_MBUF_BUFSIZ, rte::socket_id());
+
+    eth_conf conf;
+    memset(&conf, 0, sizeof(conf));
+    rte::eth_dev_configure(0, 1, 1, &conf);
+    rte::eth_rx_queue_setup(0, 0, 512, rte::socket_id(), nullptr, mp);
+    rte::eth_tx_queue_setup(0, 0, 512, rte::socket_id(), nullptr);
+    rte::eth_dev_start(0);
+}
+
+
+int main(int argc, char** argv)
+{
+    rte::eth_dev_init(argc, argv);
+
+    bench_loop<old_path>("old");
+    bench_loop<ring_path>("ring");
+
+    if (rte::eth_dev_count() == 0) {
+        printf("no port, give --vdev=eth_null0 for the port0 runs\n");
+        return 0;
+    }
+    port_setup();
+    bench_null<old_path>("old");
+    bench_null<ring_path>("ring");
+    return 0;
+}
@@ -0,0 +1,59 @@
+
+#include <stcp/stcp.h>
+#include <stcp/util.h>
+#include <stcp/mempool.h>
+
+using namespace stcp;
+
+
+/*
+ * Sends small UDP datagrams as fast as the stack takes them,
+ * for measuring the ip tx path. Watch the tx pps of PORT0
+ * and "Tx direct" of the IP module on the stat screen.
+ */
+static const size_t payload_len = 18; /* 64 byte frames */
+
+int udp_blast(void* arg)
+{
+    (void)arg;
+    mempool* mp = pool_create("UDP Blast Pool", 8192, 250,
+            ST_MBUF_BUFSIZ, rte::socket_id());
+    stcp_udp_sock* sock = core::create_udp_socket();
+
+    stcp_sockaddr_in addr;
+    addr.sin_fam  = STCP_AF_INET;
+    addr.sin_port = hton16(9999);
+    sock->bind(&addr);
+
+    stcp_sockaddr_in dst;
+    dst.sin_fam  = STCP_AF_INET;
+    dst.sin_port = hton16(9999);
+    dst.sin_addr.set(192, 168, 222, 11);
+
+    while (true) {
+        mbuf* m;
+        try {
+            m = mbuf_alloc(mp);
+        } catch (rte::exception&) {
+            continue; /* stack is behind, pool drained */
+        }
+        memset(mbuf_push(m, payload_len), 0, payload_len);
+        sock->sendto(m, &dst);
+    }
+    return 0;
+}
+
+
+int main(int argc, char** argv)
+{
+    core::init(argc, argv);
+
+    core::set_hw_addr(0x00, 0x11 , 0x22 , 0x33 , 0x44 , 0x55);
+    core::set_ip_addr(192, 168, 222, 10, 24);
+    core::set_default_gw(192, 168, 222, 1, 0);
+    core::add_arp_record(192, 168, 222, 11,
+            0x00, 0x11, 0x22, 0x33, 0x44, 0x66);
+
+    core::set_app(udp_blast, NULL);
+    core::run();
+}
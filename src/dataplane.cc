@@ -9,6 +9,88 @@
 
 namespace stcp {
 
+void dataplane::init(int argc, char** argv)
+{
+    rte::eth_dev_init(argc, argv);
+
+    /*
+     * Every port gets the same number of queues,
+     * bounded by the weakest port and the lcores we have.
+     */
+    num_queues = core::tune.nb_rxtx_queues;
+    for (size_t port=0; port<rte::eth_dev_count(); port++) {
+        struct rte_eth_dev_info dev_info;
+        rte::eth_dev_info_get(port, &dev_info);
+        if (dev_info.max_rx_queues < num_queues)
+            num_queues = dev_info.max_rx_queues;
+        if (dev_info.max_tx_queues < num_queues)
+            num_queues = dev_info.max_tx_queues;
+    }
+    if (rte::lcore_count() < num_queues)
+        num_queues = rte::lcore_count();
+    if (num_queues < 1)
+        num_queues = 1;
+    memset(lcore_queue, 0, sizeof lcore_queue);
+
+    /*
+     * rx mbufs come from a pool on the port's own node,
+     * protocol pools exist on every node we run on.
+     */
+    for (size_t port=0; port<rte::eth_dev_count(); port++)
+        port_nodes |= 1u << port_socket(port);
+    all_nodes = port_nodes;
+    for (unsigned lcore=0; lcore<RTE_MAX_LCORE; lcore++) {
+        if (rte::lcore_is_enabled(lcore))
+            all_nodes |= 1u << rte::lcore_to_socket_id(lcore);
+    }
+
+    pools.create(
+            "Dataplane Mem Pool",
+            core::tune.dataplane_mempool_nseg * rte::eth_dev_count() * num_queues,
+            core::tune.dataplane_mp_cachesiz,
+            core::tune.mbuf_bufsiz,
+            port_nodes);
+
+    for (size_t port=0; port<rte::eth_dev_count(); port++) {
+        ifnet dev(port, num_queues);
+        dev.init();
+        devices.push_back(dev);
+    }
+    nb_ports = devices.size();
+}
+
+
+/*
+ * Creates 802.1Q sub-interface vid on physical port,
+ * returns its ifindex. Must be called before core::run().
+ * Sub-interfaces are not ethdevs, only the uint8_t ifindex
+ * (mbuf port) bounds them.
+ */
+uint8_t dataplane::add_vlan(uint8_t port, uint16_t vid)
+{
+    if (running)
+        throw exception("add_vlan: dataplane already running");
+    if (port >= nb_ports)
+        throw exception("add_vlan: no such port");
+    if (vid == 0 || vid >= 4095)
+        throw exception("add_vlan: vid out of range");
+    if (vlan_dev[port][vid] != 0)
+        throw exception("add_vlan: vlan already exists");
+    if (devices.size() > UINT8_MAX)
+        throw exception("add_vlan: too many interfaces");
+
+    uint8_t idx = devices.size();
+    devices.push_back(ifnet(idx, devices[port], vid));
+    vlan_dev[port][vid] = idx;
+
+    if (devices[port].rx_offload & DEV_RX_OFFLOAD_VLAN_STRIP) {
+        if (rte::eth_dev_vlan_filter(port, vid, 1) != 0)
+            fprintf(stderr, "PORT%u: vlan filter %u not set, relying on promisc\n", port, vid);
+    }
+    return idx;
+}
+
+
 void dataplane::print_stat() const
 {
     size_t rooty = core::screen.POS_PORT.y;
@@ -17,12 +99,13 @@ void dataplane::print_stat() const
 
     core::screen.printwln("DataPlane ");
     core::screen.printwln(" Pool  : %u/%u",
-            pool_use_count(mp), pool_size(mp));
+            pools.use_count(), pools.size());
+    core::screen.printwln(" Unknown vlan drops : %zd", core::ether.rx_vlan_unknown);
 
-    size_t i=0;
+    size_t y = rooty+3;
     for (const ifnet& dev : devices) {
-        dev.print_stat(rootx, rooty+2+i*6);
-        i++;
+        dev.print_stat(rootx, y);
+        y += dev.stat_lines() + 1;
     }
 }
 
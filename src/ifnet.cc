@@ -18,36 +18,92 @@
 namespace stcp {
 
 
+/*
+ * Symmetric Toeplitz key (0x6d5a repeated).
+ * Both directions of a flow hash to the same queue,
+ * so one lcore sees every segment of a connection.
+ */
+static uint8_t rss_sym_key[40] = {
+    0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a,
+    0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a,
+    0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a,
+    0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a,
+    0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a,
+};
+
 
 void ifnet::init()
 {
+    rx_ring_size = core::tune.rx_ring_size;
+    tx_ring_size = core::tune.tx_ring_size;
+
+    struct rte_eth_dev_info dev_info;
+    rte::eth_dev_info_get(port_id, &dev_info);
+
+    /*
+     * Checksum offloads, software fallback in ip_module
+     * for PMDs without them (pcap, ring, null).
+     */
+    rx_offload = dev_info.rx_offload_capa & (DEV_RX_OFFLOAD_IPV4_CKSUM
+                                           | DEV_RX_OFFLOAD_TCP_CKSUM
+                                           | DEV_RX_OFFLOAD_UDP_CKSUM
+                                           | DEV_RX_OFFLOAD_VLAN_STRIP);
+    tx_offload = dev_info.tx_offload_capa & (DEV_TX_OFFLOAD_IPV4_CKSUM
+                                           | DEV_TX_OFFLOAD_TCP_CKSUM
+                                           | DEV_TX_OFFLOAD_UDP_CKSUM
+                                           | DEV_TX_OFFLOAD_TCP_TSO
+                                           | DEV_TX_OFFLOAD_VLAN_INSERT);
+    /* TSO seeds the tcp cksum with the pseudo header */
+    if ((tx_offload & DEV_TX_OFFLOAD_TCP_CKSUM) == 0)
+        tx_offload &= ~DEV_TX_OFFLOAD_TCP_TSO;
+
     eth_conf port_conf;
     memset(&port_conf, 0, sizeof port_conf);
     port_conf.rxmode.max_rx_pkt_len = ETHER_MAX_LEN;
+    if (rx_offload & ~DEV_RX_OFFLOAD_VLAN_STRIP)
+        port_conf.rxmode.hw_ip_checksum = 1;
+    if (rx_offload & DEV_RX_OFFLOAD_VLAN_STRIP)
+        port_conf.rxmode.hw_vlan_strip = 1;
+    if (num_rx_rings > 1) {
+        port_conf.rxmode.mq_mode = ETH_MQ_RX_RSS;
+        port_conf.rx_adv_conf.rss_conf.rss_key     = rss_sym_key;
+        port_conf.rx_adv_conf.rss_conf.rss_key_len = sizeof(rss_sym_key);
+        port_conf.rx_adv_conf.rss_conf.rss_hf      =
+            (ETH_RSS_IP|ETH_RSS_TCP|ETH_RSS_UDP) & dev_info.flow_type_rss_offloads;
+    }
     rte::eth_dev_configure(port_id, num_rx_rings, num_tx_rings, &port_conf);
 
     dataplane& d = core::dplane;
     for (uint16_t ring=0; ring<num_rx_rings; ring++) {
         rte::eth_rx_queue_setup(port_id, ring, rx_ring_size,
-                rte::eth_dev_socket_id(port_id), NULL, d.mp);
+                rte::eth_dev_socket_id(port_id), NULL, d.rx_pool(port_id));
     }
+    /*
+     * Fragments are sent as chained mbufs, so multi-segment
+     * tx is always needed; checksum offload only if probed.
+     */
+    struct rte_eth_txconf txconf = dev_info.default_txconf;
+    txconf.txq_flags &= ~ETH_TXQ_FLAGS_NOMULTSEGS;
+    if (tx_offload & DEV_TX_OFFLOAD_TCP_CKSUM)
+        txconf.txq_flags &= ~ETH_TXQ_FLAGS_NOXSUMTCP;
+    if (tx_offload & DEV_TX_OFFLOAD_UDP_CKSUM)
+        txconf.txq_flags &= ~ETH_TXQ_FLAGS_NOXSUMUDP;
+    if (tx_offload & DEV_TX_OFFLOAD_VLAN_INSERT)
+        txconf.txq_flags &= ~ETH_TXQ_FLAGS_NOVLANOFFL;
     for (uint16_t ring=0; ring<num_tx_rings; ring++) {
         rte::eth_tx_queue_setup(port_id, ring, tx_ring_size,
-                rte::eth_dev_socket_id(port_id), NULL);
+                rte::eth_dev_socket_id(port_id), &txconf);
     }
     rte::eth_dev_start(port_id);
 
+    tx_drain_cycles = (rte::get_tsc_hz() + US_PER_S - 1) / US_PER_S * core::tune.tx_drain_us;
+
     if (promiscuous_mode)
         rte::eth_promiscuous_enable(port_id);
 
-    if (rte::eth_dev_socket_id(port_id) > 0 &&
-            rte::eth_dev_socket_id(port_id) != (int)rte::socket_id()) {
-        std::string str;
-        str = "WARNING: port" + std::to_string(port_id);
-        str += "is on remote NUMA node to ";
-        str += "polling thread. \n\tPerformance will ";
-        str += "not be optimal. \n ";
-        throw rte::exception(str.c_str());
+    if (dataplane::port_socket(port_id) != (int)rte::socket_id()) {
+        fprintf(stderr, "WARNING: port%u is on remote NUMA node to "
+                "master lcore, queue 0 will poll it across nodes\n", port_id);
     }
 
 
@@ -61,40 +117,72 @@ void ifnet::init()
     addrs.push_back(ifa);
 }
 
-uint16_t ifnet::io_rx()
+/*
+ * Received burst is handed back in bufs as is,
+ * there is no intermediate rx queue.
+ */
+uint16_t ifnet::io_rx(uint16_t qid, mbuf** bufs, uint16_t nb_bufs)
 {
-    mbuf* bufs[BURST_SIZE];
-    uint16_t num_rx = rte::eth_rx_burst(port_id, 0, bufs, BURST_SIZE);
-    if (unlikely(num_rx == 0)) return 0;
+    return rte::eth_rx_burst(port_id, qid, bufs, nb_bufs);
+}
 
-    for (uint16_t i=0; i<num_rx; i++) {
-        rx.push(bufs[i]);
+/*
+ * Frames are buffered per port and queue and go out
+ * as soon as a full burst is collected. Partial bursts
+ * are flushed by core::ifs_proc() after tx_drain_us.
+ */
+void ifnet::tx_push(uint16_t qid, mbuf* msg)
+{
+    if (is_vlan()) {
+        if (tx_offload & DEV_TX_OFFLOAD_VLAN_INSERT) {
+            msg->ol_flags |= PKT_TX_VLAN_PKT;
+            msg->vlan_tci  = vlan_id;
+        } else {
+            msg->l2_len += sizeof(stcp_vlan_header); /* tag written by ether */
+        }
+        core::dplane.devices[parent_port].tx_push(qid, msg);
+        return;
     }
 
-    return num_rx;
+    if (unlikely(!tx[qid].push(msg))) {
+        rte::pktmbuf_free(msg);
+        txs[qid].drops++;
+        return;
+    }
+    uint16_t burst = core::tune.burst_size;
+    if (tx[qid].size() >= burst && !txs[qid].stalled) {
+        io_tx(qid, burst);
+    }
 }
 
-uint16_t ifnet::io_tx(size_t num_request_to_send)
+/*
+ * Frames the NIC does not take stay at the head of the
+ * backlog and are retried on the next core::ifs_proc().
+ */
+uint16_t ifnet::io_tx(uint16_t qid, size_t num_request_to_send)
 {
-    if (num_request_to_send > tx.size()) {
-        num_request_to_send = tx.size();
+    pkt_queue& q = tx[qid];
+    txs[qid].flush_tsc = rte::get_tsc_cycles();
+    txs[qid].stalled   = false;
+    if (num_request_to_send > q.size()) {
+        num_request_to_send = q.size();
     }
 
     mbuf* bufs[BURST_SIZE];
     uint16_t num_tx_sum = 0;
-    size_t i=0;
-    for (size_t num_sent=0; num_sent<num_request_to_send; num_sent+=i) {
-        for (i=0; i+num_sent<num_request_to_send; i++) {
-            bufs[i] = tx_pop();
-        }
-        uint16_t num_tx = rte::eth_tx_burst(port_id, 0, bufs, i);
+    while (num_tx_sum < num_request_to_send) {
+        size_t n = num_request_to_send - num_tx_sum;
+        if (n > BURST_SIZE) n = BURST_SIZE;
+        n = q.peek_bulk(bufs, n);
 
-        if (num_tx < i) {
-            for (uint16_t j=0; j<i-num_tx; j++) {
-                rte::pktmbuf_free(bufs[num_tx+j]);
-            }
-        }
+        uint16_t num_tx = rte::eth_tx_burst(port_id, qid, bufs, n);
+        q.consume(num_tx);
         num_tx_sum += num_tx;
+
+        if (num_tx < n) {
+            txs[qid].stalled = true;
+            break;
+        }
     }
 
     return num_tx_sum;
@@ -114,8 +202,47 @@ static const char* af2str(stcp_sa_family af)
 void ifnet::print_stat(size_t rootx, size_t rooty) const
 {
     core::screen.move(rooty, rootx);
-    core::screen.printwln(" %s: %s", name.c_str(), promiscuous_mode?"PROMISC":"");
+    if (is_vlan()) {
+        core::screen.printwln(" %s: vlan %u tag=%s", name.c_str(), vlan_id,
+                vlan_sw_tag() ? "sw" : "hw");
+        print_addrs();
+        return;
+    }
 
+    uint32_t csum = DEV_TX_OFFLOAD_IPV4_CKSUM|DEV_TX_OFFLOAD_TCP_CKSUM|DEV_TX_OFFLOAD_UDP_CKSUM;
+    core::screen.printwln(" %s: %s queues=%u csum-offload rx/tx=%s/%s tso=%s vlan-offload=%s",
+            name.c_str(), promiscuous_mode?"PROMISC":"", num_rx_rings,
+            (rx_offload & ~DEV_RX_OFFLOAD_VLAN_STRIP)?"on":"off",
+            (tx_offload & csum)?"on":"off",
+            (tx_offload & DEV_TX_OFFLOAD_TCP_TSO)?"on":"off",
+            (tx_offload & DEV_TX_OFFLOAD_VLAN_INSERT)?"on":"off");
+
+    uint64_t now = rte::get_tsc_cycles();
+    uint64_t hz  = rte::get_tsc_hz();
+    if (now - prev_tsc >= hz) {
+        struct rte_eth_stats st;
+        rte::eth_stats_get(port_id, &st);
+        rx_pps = (st.ipackets - prev_ipackets) * hz / (now - prev_tsc);
+        tx_pps = (st.opackets - prev_opackets) * hz / (now - prev_tsc);
+        prev_ipackets = st.ipackets;
+        prev_opackets = st.opackets;
+        prev_tsc      = now;
+    }
+    core::screen.printwln("  rx/tx %lu/%lu pps ", rx_pps, tx_pps);
+
+    uint64_t backlog = 0;
+    uint64_t drops   = 0;
+    for (size_t i=0; i<tx.size(); i++) {
+        backlog += tx[i].size();
+        drops   += txs[i].drops;
+    }
+    core::screen.printwln("  tx backlog/drops %lu/%lu ", backlog, drops);
+    print_addrs();
+}
+
+
+void ifnet::print_addrs() const
+{
     for (const ifaddr& ifa : addrs) {
         if (ifa.family == STCP_AF_LINK) {
             core::screen.printwln(
@@ -183,6 +310,18 @@ void ifnet::ioctl(uint64_t request, void* arg)
             ioctl_siocpromisc(val);
             break;
         }
+        case STCP_SIOCAIFADDR:
+        {
+            const stcp_ifreq* ifr = reinterpret_cast<const stcp_ifreq*>(arg);
+            ioctl_siocaifaddr(ifr);
+            break;
+        }
+        case STCP_SIOCDIFADDR:
+        {
+            const stcp_ifreq* ifr = reinterpret_cast<const stcp_ifreq*>(arg);
+            ioctl_siocdifaddr(ifr);
+            break;
+        }
         default:
         {
             throw exception("invalid arguments");
@@ -204,17 +343,23 @@ void ifnet::ioctl_siocpromisc(const uint64_t* val)
 }
 
 
+/*
+ * Sets the primary address, the first inet one.
+ * It is the source towards this interface and
+ * with the netmask gives the connected route.
+ */
 void ifnet::ioctl_siocsifaddr(const stcp_ifreq* ifr)
 {
-    bool in_addr_setted = false;
+    const stcp_sockaddr_in* sin =
+        reinterpret_cast<const stcp_sockaddr_in*>(&ifr->if_addr);
 
+    bool in_addr_setted = false;
     for (size_t i=0; i<addrs.size(); i++) {
         if (addrs[i].family == STCP_AF_INET) {
-            const struct stcp_sockaddr_in* sin =
-                reinterpret_cast<const stcp_sockaddr_in*>(&ifr->if_addr);
             stcp_sockaddr_in* s = reinterpret_cast<stcp_sockaddr_in*>(&addrs[i].raw);
             s->sin_addr = sin->sin_addr;
             in_addr_setted = true;
+            break;
         }
     }
 
@@ -222,12 +367,45 @@ void ifnet::ioctl_siocsifaddr(const stcp_ifreq* ifr)
         struct ifaddr ifa_new(STCP_AF_INET, &ifr->if_addr);
         addrs.push_back(ifa_new);
     }
+    core::ip.ifaddr_changed();
+}
 
-    stcp_in_addr ad;
-    const stcp_sockaddr_in* s = reinterpret_cast<const stcp_sockaddr_in*>(&ifr->if_addr);
-    for (size_t i=0; i<stcp_in_addr::addrlen; i++)
-        ad.addr_bytes[i] = s->sin_addr.addr_bytes[i];
-    core::ip.set_ipaddr(&ad);
+
+/*
+ * Adds a secondary address, local for rx (e.g. a service
+ * VIP) but not in the connected route. The first address
+ * added becomes the primary.
+ */
+void ifnet::ioctl_siocaifaddr(const stcp_ifreq* ifr)
+{
+    const stcp_sockaddr_in* sin =
+        reinterpret_cast<const stcp_sockaddr_in*>(&ifr->if_addr);
+
+    for (const ifaddr& ifa : addrs) {
+        const stcp_sockaddr_in* s = reinterpret_cast<const stcp_sockaddr_in*>(&ifa.raw);
+        if (ifa.family == STCP_AF_INET && s->sin_addr == sin->sin_addr)
+            throw exception("inet address already exists");
+    }
+    struct ifaddr ifa_new(STCP_AF_INET, &ifr->if_addr);
+    addrs.push_back(ifa_new);
+    core::ip.ifaddr_changed();
+}
+
+
+void ifnet::ioctl_siocdifaddr(const stcp_ifreq* ifr)
+{
+    const stcp_sockaddr_in* sin =
+        reinterpret_cast<const stcp_sockaddr_in*>(&ifr->if_addr);
+
+    for (size_t i=0; i<addrs.size(); i++) {
+        const stcp_sockaddr_in* s = reinterpret_cast<const stcp_sockaddr_in*>(&addrs[i].raw);
+        if (addrs[i].family == STCP_AF_INET && s->sin_addr == sin->sin_addr) {
+            addrs.erase(addrs.begin() + i);
+            core::ip.ifaddr_changed();
+            return;
+        }
+    }
+    throw exception("not found inet address");
 }
 
 void ifnet::ioctl_siocsifnetmask(const stcp_ifreq* ifr)
@@ -248,6 +426,7 @@ void ifnet::ioctl_siocsifnetmask(const stcp_ifreq* ifr)
         struct ifaddr ifa_new(STCP_AF_INMASK, &ifr->if_addr);
         addrs.push_back(ifa_new);
     }
+    core::ip.ifaddr_changed();
 }
 
 
@@ -303,6 +482,15 @@ void ifnet::ioctl_siocsifhwaddr(const stcp_ifreq* ifr)
         struct ifaddr ifa_new(STCP_AF_LINK, &ifr->if_hwaddr);
         addrs.push_back(ifa_new);
     }
+    core::arp.l2_invalidate(port_id);
+
+    /* sub-interfaces share the parent's mac */
+    if (!is_vlan()) {
+        for (ifnet& dev : core::dplane.devices) {
+            if (dev.is_vlan() && dev.parent_port == port_id)
+                dev.ioctl_siocsifhwaddr(ifr);
+        }
+    }
 }
 
 
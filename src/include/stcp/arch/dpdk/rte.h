@@ -23,6 +23,10 @@
 #include <rte_hexdump.h>
 #include <rte_ip.h>
 #include <rte_ip_frag.h>
+#include <rte_jhash.h>
+#include <rte_hash.h>
+#include <rte_lpm.h>
+#include <rte_memcpy.h>
 #include <stcp/config.h>
 
 
@@ -134,6 +138,19 @@ inline struct rte_mempool* pktmbuf_pool_create(const char* name, uint32_t n,
     return mbuf_pool;
 }
 
+inline void eth_dev_info_get(uint8_t port_id, struct rte_eth_dev_info* dev_info)
+{
+    rte_eth_dev_info_get(port_id, dev_info);
+}
+
+inline void eth_stats_get(uint8_t port_id, struct rte_eth_stats* stats)
+{
+    int ret = rte_eth_stats_get(port_id, stats);
+    if (ret != 0) {
+        throw rte::exception("rte_eth_stats_get");
+    }
+}
+
 inline size_t eth_dev_count()
 {
     return rte_eth_dev_count();
@@ -144,6 +161,21 @@ inline size_t lcore_count()
     return rte_lcore_count();
 }
 
+inline unsigned lcore_id()
+{
+    return rte_lcore_id();
+}
+
+inline unsigned lcore_to_socket_id(unsigned lcore_id)
+{
+    return rte_lcore_to_socket_id(lcore_id);
+}
+
+inline bool lcore_is_enabled(unsigned lcore_id)
+{
+    return rte_lcore_is_enabled(lcore_id) == 1;
+}
+
 inline void eth_macaddr_get(uint8_t port_id, struct ether_addr* mac_addr)
 {
     rte_eth_macaddr_get(port_id, mac_addr);
@@ -191,6 +223,11 @@ inline int eth_dev_socket_id(uint8_t port_id)
     return rte_eth_dev_socket_id(port_id);
 }
 
+inline int eth_dev_vlan_filter(uint8_t port_id, uint16_t vlan_id, int on)
+{
+    return rte_eth_dev_vlan_filter(port_id, vlan_id, on);
+}
+
 inline rte_mbuf* pktmbuf_alloc(struct rte_mempool* mp)
 {
     rte_mbuf* buf = rte_pktmbuf_alloc(mp);
@@ -213,6 +250,10 @@ inline rte_mbuf* pktmbuf_clone(rte_mbuf* md, struct rte_mempool* mp)
     return buf;
 }
 
+inline void pktmbuf_attach(rte_mbuf* mi, rte_mbuf* m)
+{
+    rte_pktmbuf_attach(mi, m);
+}
 inline uint16_t pktmbuf_headroom(const rte_mbuf* m)
 {
     return rte_pktmbuf_headroom(m);
@@ -295,7 +336,85 @@ inline void free(void* ptr)
 {
     rte_free(ptr);
 }
+inline void* zmalloc(const char* type, size_t size, unsigned align)
+{
+    void* p = rte_zmalloc(type, size, align);
+    if (!p) {
+        throw rte::exception("rte_zmalloc");
+    }
+    return p;
+}
+inline uint32_t jhash_2words(uint32_t a, uint32_t b, uint32_t initval)
+{
+    return rte_jhash_2words(a, b, initval);
+}
+
+inline struct rte_lpm* lpm_create(const char* name, int socket_id,
+        uint32_t max_rules, uint32_t number_tbl8s)
+{
+    struct rte_lpm_config conf;
+    memset(&conf, 0, sizeof conf);
+    conf.max_rules    = max_rules;
+    conf.number_tbl8s = number_tbl8s;
+    struct rte_lpm* lpm = rte_lpm_create(name, socket_id, &conf);
+    if (!lpm) {
+        throw rte::exception("rte_lpm_create");
+    }
+    return lpm;
+}
+inline void lpm_add(struct rte_lpm* lpm, uint32_t ip, uint8_t depth, uint32_t next_hop)
+{
+    int ret = rte_lpm_add(lpm, ip, depth, next_hop);
+    if (ret < 0) {
+        throw rte::exception("rte_lpm_add");
+    }
+}
+inline int lpm_delete(struct rte_lpm* lpm, uint32_t ip, uint8_t depth)
+{
+    return rte_lpm_delete(lpm, ip, depth);
+}
+inline void lpm_delete_all(struct rte_lpm* lpm)
+{
+    rte_lpm_delete_all(lpm);
+}
+inline int lpm_lookup(struct rte_lpm* lpm, uint32_t ip, uint32_t* next_hop)
+{
+    return rte_lpm_lookup(lpm, ip, next_hop);
+}
 
+inline struct rte_hash* hash_create(const char* name, uint32_t entries,
+        uint32_t key_len, int socket_id)
+{
+    struct rte_hash_parameters param;
+    memset(&param, 0, sizeof param);
+    param.name      = name;
+    param.entries   = entries;
+    param.key_len   = key_len;
+    param.hash_func = rte_jhash;
+    param.socket_id = socket_id;
+    struct rte_hash* h = rte_hash_create(&param);
+    if (!h) {
+        throw rte::exception("rte_hash_create");
+    }
+    return h;
+}
+inline int32_t hash_add_key_data(const struct rte_hash* h, const void* key, void* data)
+{
+    return rte_hash_add_key_data(h, key, data);
+}
+inline int hash_lookup_data(const struct rte_hash* h, const void* key, void** data)
+{
+    return rte_hash_lookup_data(h, key, data);
+}
+inline int32_t hash_del_key(const struct rte_hash* h, const void* key)
+{
+    return rte_hash_del_key(h, key);
+}
+
+inline void mov16(void* dst, const void* src)
+{
+    rte_mov16(reinterpret_cast<uint8_t*>(dst), reinterpret_cast<const uint8_t*>(src));
+}
 inline void* memcpy(void* dst, const void* src, size_t n)
 {
     return rte_memcpy(dst, src, n);
@@ -365,6 +484,40 @@ inline struct rte_mbuf* ipv4_frag_reassemble_packet(
     return rte_ipv4_frag_reassemble_packet(tbl, dr, mb, tms, iph);
 }
 
+inline void ip_frag_free_death_row(struct rte_ip_frag_death_row* dr, uint32_t prefetch)
+{
+    rte_ip_frag_free_death_row(dr, prefetch);
+}
+
+/*
+ * Removes the oldest entry of tbl if it started before
+ * now - max_cycles, moving its fragments to dr. Same as
+ * the library's own ip_frag_tbl_del(), which 16.07 does not
+ * export and only runs when a later fragment hits the entry.
+ * Returns false when there was nothing to expire.
+ */
+inline bool ip_frag_tbl_expire_oldest(struct rte_ip_frag_tbl* tbl,
+        struct rte_ip_frag_death_row* dr, uint64_t now)
+{
+    struct ip_frag_pkt* fp = TAILQ_FIRST(&tbl->lru);
+    if (fp == nullptr || now - fp->start < tbl->max_cycles)
+        return false;
+
+    for (uint32_t i=0; i<fp->last_idx; i++) {
+        if (fp->frags[i].mb != nullptr) {
+            dr->row[dr->cnt++] = fp->frags[i].mb;
+            fp->frags[i].mb = nullptr;
+        }
+    }
+    fp->last_idx     = 0;
+    fp->key.key_len  = 0;
+    TAILQ_REMOVE(&tbl->lru, fp, lru);
+    tbl->use_entries--;
+    if (tbl->last == fp)
+        tbl->last = nullptr;
+    return true;
+}
+
 
 
 template <class T>
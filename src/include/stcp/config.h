@@ -5,10 +5,12 @@
 #include <stcp/arch/dpdk/rte.h>
 #include <queue>
 #include <mutex>
+#include <atomic>
 #include <stdio.h>
 #include <stdarg.h>
 #include <stcp/ncurses.h>
 #include <stcp/filefd.h>
+#include <stcp/tuning.h>
 
 
 namespace stcp {
@@ -25,29 +27,76 @@ using ip_frag_tbl       = struct rte_ip_frag_tbl;
 
 
 
-class pkt_queue {
-    std::queue<mbuf*> queue;
+/*
+ * Fixed-capacity ring of mbufs for the rx/tx hot path.
+ * Capacity is a power of two, storage is inline,
+ * nothing is allocated after construction.
+ * Not thread safe: each ring is owned by one lcore.
+ */
+template <size_t N>
+class mbuf_ring {
+    static_assert(N != 0 && (N & (N-1)) == 0, "mbuf_ring size must be power of 2");
+    static const size_t mask = N - 1;
+
+    size_t head; /* next slot to push */
+    size_t tail; /* next slot to pop  */
+    mbuf* ring[N];
+
 public:
-    void push(mbuf* msg)
+    mbuf_ring() : head(0), tail(0) {}
+
+    bool push(mbuf* msg)
     {
-        queue.push(msg);
+        if (unlikely(full())) return false;
+        ring[head++ & mask] = msg;
+        return true;
     }
     mbuf* pop()
     {
-        mbuf* msg = queue.front();
-        queue.pop();
-        return msg;
+        return ring[tail++ & mask];
     }
-    size_t size() const
+
+    /*
+     * Returns number of mbufs actually moved.
+     */
+    size_t push_bulk(mbuf* const* msgs, size_t n)
     {
-        return queue.size();
+        if (n > N - size()) n = N - size();
+        for (size_t i=0; i<n; i++) {
+            ring[(head + i) & mask] = msgs[i];
+        }
+        head += n;
+        return n;
     }
-    bool empty() const
+    size_t pop_bulk(mbuf** msgs, size_t n)
     {
-        return queue.empty();
+        n = peek_bulk(msgs, n);
+        tail += n;
+        return n;
+    }
+
+    /*
+     * Copies out without consuming, pair with consume()
+     * to drop only what was actually handled.
+     */
+    size_t peek_bulk(mbuf** msgs, size_t n) const
+    {
+        if (n > size()) n = size();
+        for (size_t i=0; i<n; i++) {
+            msgs[i] = ring[(tail + i) & mask];
+        }
+        return n;
     }
+    void consume(size_t n) { tail += n; }
+
+    size_t size() const { return head - tail; }
+    bool empty() const { return head == tail; }
+    bool full() const { return size() == N; }
+    static size_t capacity() { return N; }
 };
 
+using pkt_queue = mbuf_ring<ST_PKTQUEUE_SIZE>;
+
 
 template<class T>
 class queue_TS {
@@ -67,6 +116,11 @@ public:
         queue.pop();
         return msg;
     }
+    T front() const
+    {
+        auto_lock lg(m);
+        return queue.front();
+    }
     size_t size() const
     {
         auto_lock lg(m);
@@ -79,4 +133,130 @@ public:
     }
 };
 
+
+/*
+ * FIFO of mbufs linked through userdata, like the arp pending
+ * frames. It allocates nothing, not even when constructed, so
+ * that it can sit in the socket slabs. Not thread safe.
+ */
+class mbuf_list {
+    mbuf*  head;
+    mbuf*  tail;
+    size_t nb;
+public:
+    mbuf_list() : head(nullptr), tail(nullptr), nb(0) {}
+    void push(mbuf* msg)
+    {
+        msg->userdata = nullptr;
+        if (tail != nullptr)
+            tail->userdata = msg;
+        else
+            head = msg;
+        tail = msg;
+        nb++;
+    }
+    mbuf* pop()
+    {
+        mbuf* msg = head;
+        head = reinterpret_cast<mbuf*>(msg->userdata);
+        if (head == nullptr)
+            tail = nullptr;
+        msg->userdata = nullptr;
+        nb--;
+        return msg;
+    }
+    mbuf* front() const { return head; }
+    static mbuf* next(const mbuf* msg) { return reinterpret_cast<mbuf*>(msg->userdata); }
+    size_t size() const { return nb; }
+    bool empty() const { return head == nullptr; }
+};
+
+
+/*
+ * mbuf_list shared with user apps.
+ */
+class mbuf_queue_TS {
+    mbuf_list list;
+    mutable std::mutex m;
+    using auto_lock=std::lock_guard<std::mutex>;
+public:
+    void push(mbuf* msg)
+    {
+        auto_lock lg(m);
+        list.push(msg);
+    }
+    mbuf* pop()
+    {
+        auto_lock lg(m);
+        return list.pop();
+    }
+    size_t size() const
+    {
+        auto_lock lg(m);
+        return list.size();
+    }
+    bool empty() const
+    {
+        auto_lock lg(m);
+        return list.empty();
+    }
+};
+
+
+/*
+ * Sockets having work for proc(), queued by the lcore that
+ * made the work and drained by the stack under stack_lock.
+ * Each lcore pushes to its own queue and marks it in busy,
+ * a drain locks only the marked queues. The socket keeps a
+ * flag so that it is queued once until drained.
+ */
+template<class T>
+class work_list {
+    static const size_t nb_lists = RTE_MAX_LCORE + 1; /* last one for non-EAL threads */
+    static const size_t nb_words = (nb_lists + 63) / 64;
+
+    queue_TS<T*> lists[nb_lists];
+    std::atomic<uint64_t> busy[nb_words]; /* lists maybe non-empty  */
+    std::atomic<size_t> nb_queued;        /* lets an idle drain skip */
+public:
+    work_list() : nb_queued(0)
+    {
+        for (std::atomic<uint64_t>& w : busy)
+            w = 0;
+    }
+    void push(T* s)
+    {
+        unsigned lcore = rte::lcore_id();
+        if (unlikely(lcore >= RTE_MAX_LCORE))
+            lcore = RTE_MAX_LCORE;
+        lists[lcore].push(s);
+        nb_queued++;
+        /* after the push, so that a drain clearing it sees s */
+        busy[lcore / 64].fetch_or(uint64_t(1) << (lcore % 64));
+    }
+    /*
+     * Sockets pushed again by func are left for the next drain.
+     */
+    template<class F>
+    void drain(F func)
+    {
+        if (nb_queued == 0)
+            return;
+        for (size_t i=0; i<nb_words; i++) {
+            uint64_t w = busy[i].exchange(0);
+            while (w != 0) {
+                size_t bit = __builtin_ctzll(w);
+                w &= w - 1;
+                queue_TS<T*>& l = lists[i * 64 + bit];
+                for (size_t n=l.size(); n>0; n--) {
+                    T* s = l.pop();
+                    nb_queued--;
+                    func(s);
+                }
+            }
+        }
+    }
+    size_t size() const { return nb_queued; }
+};
+
 } /* namespace */
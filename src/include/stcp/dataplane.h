@@ -24,29 +24,77 @@ namespace stcp {
 
 class dataplane {
     friend class ifnet;
-    mempool* mp;
+    numa_pools pools;                    /* rx pools, on port nodes */
+    uint16_t num_queues;                 /* rx/tx queues per port  */
+    uint16_t lcore_queue[RTE_MAX_LCORE]; /* lcore_id -> queue id   */
+    uint32_t port_nodes;                 /* nodes having a port    */
+    uint32_t all_nodes;                  /* port or lcore nodes    */
+    uint8_t  nb_ports;                   /* physical ports         */
+    uint8_t  vlan_dev[RTE_MAX_ETHPORTS][4096]; /* vid -> ifindex, 0 none */
+    bool     running;                    /* devices is fixed       */
 public:
 
-    dataplane() : mp(nullptr) {}
+    dataplane() : num_queues(1), port_nodes(0), all_nodes(0), nb_ports(0), running(false)
+    { memset(vlan_dev, 0, sizeof vlan_dev); }
     ~dataplane() {}
 
     std::vector<ifnet> devices;
-    void init(int argc, char** argv)
+    void init(int argc, char** argv);
+    uint16_t nb_queues() const { return num_queues; }
+    uint32_t numa_nodes() const { return all_nodes; }
+    uint8_t num_ports() const { return nb_ports; }
+    uint8_t add_vlan(uint8_t port, uint16_t vid);
+
+    /*
+     * Polling lcores walk devices without stack_lock
+     * from here on, no interface may be added.
+     */
+    void start() { running = true; }
+
+    /*
+     * ifindex of vid on port, 0 if no such sub-interface
+     * (ifindex 0 is always a physical port).
+     */
+    uint8_t vlan_ifindex(uint8_t port, uint16_t vid) const
+    {
+        return vlan_dev[port][vid & 0x0fff];
+    }
+    mempool* rx_pool(uint8_t port) const { return pools.on(port_socket(port)); }
+
+    /*
+     * NUMA node of port, 0 if the PMD does not know.
+     */
+    static int port_socket(uint8_t port)
     {
-        rte::eth_dev_init(argc, argv);
-        mp = pool_create(
-                "Dataplane Mem Pool",
-                ST_DATAPLANE_MEMPOOL_NSEG * rte::eth_dev_count(),
-                ST_DATAPLANE_MP_CACHESIZ,
-                ST_MBUF_BUFSIZ,
-                rte::socket_id());
-
-        for (size_t port=0; port<rte::eth_dev_count(); port++) {
-            ifnet dev(port);
-            dev.init();
-            devices.push_back(dev);
+        int node = rte::eth_dev_socket_id(port);
+        return (node < 0 || node >= RTE_MAX_NUMA_NODES) ? 0 : node;
+    }
+
+    /*
+     * Node holding most ports, polling lcores go there.
+     */
+    int poll_socket() const
+    {
+        int best = 0;
+        size_t best_cnt = 0;
+        for (int node=0; node<RTE_MAX_NUMA_NODES; node++) {
+            size_t cnt = 0;
+            for (size_t port=0; port<nb_ports; port++) {
+                if (port_socket(port) == node) cnt++;
+            }
+            if (cnt > best_cnt) {
+                best = node;
+                best_cnt = cnt;
+            }
         }
+        return best;
     }
+    void bind_lcore(unsigned lcore_id, uint16_t qid) { lcore_queue[lcore_id] = qid; }
+
+    /*
+     * Queue polled by the calling lcore.
+     */
+    uint16_t queue_id() const { return lcore_queue[rte::lcore_id()]; }
     void print_stat() const;
 };
 
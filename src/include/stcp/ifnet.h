@@ -11,51 +11,147 @@ namespace stcp {
 
 
 enum {
-    BURST_SIZE = 64,
+    BURST_SIZE      = 64, /* max of tuning_params::burst_size */
+    PREFETCH_OFFSET = 3, /* packets to prefetch ahead in a burst */
 };
 
 
 class ifnet {
 private:
-    pkt_queue rx;
-    pkt_queue tx;
+    struct txq_state {
+        uint64_t flush_tsc; /* tsc of last flush                  */
+        uint64_t drops;     /* dropped because backlog overflowed */
+        bool     stalled;   /* NIC refused part of the last burst */
+        txq_state() : flush_tsc(0), drops(0), stalled(false) {}
+    };
+    std::vector<pkt_queue> tx;  /* backlog, indexed by queue id */
+    std::vector<txq_state> txs; /* indexed by queue id          */
+    uint64_t tx_drain_cycles;
     std::string name;
 
     /*
      * TODO use static variable or enum
      */
     uint8_t  port_id;
+    uint8_t  parent_port;      /* physical port, port_id unless vlan */
+    uint16_t vlan_id;          /* 802.1Q vid, 0 on physical ports    */
     uint16_t rx_ring_size;     /* rx ring size */
     uint16_t tx_ring_size;     /* tx ring size */
     uint16_t num_rx_rings;     /* num of rx_rings per port */
     uint16_t num_tx_rings;     /* num of tx_rings per port */
 
+    /*
+     * for print_stat(), refreshed once a second
+     */
+    mutable uint64_t prev_tsc;
+    mutable uint64_t prev_ipackets;
+    mutable uint64_t prev_opackets;
+    mutable uint64_t rx_pps;
+    mutable uint64_t tx_pps;
+
 public:
     bool promiscuous_mode;
     std::vector<ifaddr> addrs;
+    uint32_t rx_offload; /* DEV_RX_OFFLOAD_* enabled on this port */
+    uint32_t tx_offload; /* DEV_TX_OFFLOAD_* enabled on this port */
 
-    ifnet(uint8_t p) :
+    ifnet(uint8_t p, uint16_t nb_queues) :
+        tx(nb_queues),
+        txs(nb_queues),
+        tx_drain_cycles(0),
         port_id(p),
-        rx_ring_size(128),
-        tx_ring_size(512),
-        num_rx_rings(1  ),
-        num_tx_rings(1  ),
-        promiscuous_mode(true)
+        parent_port(p),
+        vlan_id(0),
+        rx_ring_size(ST_RX_RING_SIZE),
+        tx_ring_size(ST_TX_RING_SIZE),
+        num_rx_rings(nb_queues),
+        num_tx_rings(nb_queues),
+        prev_tsc(0),
+        prev_ipackets(0),
+        prev_opackets(0),
+        rx_pps(0),
+        tx_pps(0),
+        promiscuous_mode(true),
+        rx_offload(0),
+        tx_offload(0)
     { name = "PORT" + std::to_string(port_id); }
 
+    /*
+     * VLAN sub-interface vid on parent, as ifindex idx.
+     * It has no queues of its own: rx frames are handed to it
+     * by ether_module, tx frames go out of the parent.
+     */
+    ifnet(uint8_t idx, const ifnet& parent, uint16_t vid) :
+        tx_drain_cycles(0),
+        port_id(idx),
+        parent_port(parent.port_id),
+        vlan_id(vid),
+        rx_ring_size(0),
+        tx_ring_size(0),
+        num_rx_rings(0),
+        num_tx_rings(0),
+        prev_tsc(0),
+        prev_ipackets(0),
+        prev_opackets(0),
+        rx_pps(0),
+        tx_pps(0),
+        promiscuous_mode(parent.promiscuous_mode),
+        rx_offload(parent.rx_offload),
+        tx_offload(parent.tx_offload)
+    {
+        name = parent.name + "." + std::to_string(vid);
+        for (const ifaddr& ifa : parent.addrs) {
+            if (ifa.family == STCP_AF_LINK)
+                addrs.push_back(ifa);
+        }
+    }
+
+    bool is_vlan() const { return vlan_id != 0; }
+    uint16_t vid() const { return vlan_id; }
+    uint8_t parent() const { return parent_port; }
+
+    /*
+     * true if ether_module must write the 802.1Q tag itself.
+     */
+    bool vlan_sw_tag() const
+    {
+        return vlan_id != 0 && (tx_offload & DEV_TX_OFFLOAD_VLAN_INSERT) == 0;
+    }
+
     void init();
-    uint16_t io_rx();
-    uint16_t io_tx(size_t num_request_to_send);
-    size_t rx_size() { return rx.size(); }
-    size_t tx_size() { return tx.size(); }
-    bool   rx_empty() { return rx.empty(); }
-    bool   tx_empty() { return tx.empty(); }
+    uint16_t io_rx(uint16_t qid, mbuf** bufs, uint16_t nb_bufs);
+    uint16_t io_tx(uint16_t qid, size_t num_request_to_send);
+    size_t tx_size(uint16_t qid) { return tx[qid].size(); }
+    bool   tx_empty(uint16_t qid) { return tx[qid].empty(); }
+
+    /*
+     * true if a partial burst has waited tx_drain_us,
+     * or the NIC refused frames last time and we must retry.
+     */
+    bool tx_drain_due(uint16_t qid, uint64_t now) const
+    {
+        if (tx[qid].empty()) return false;
+        return txs[qid].stalled || now - txs[qid].flush_tsc >= tx_drain_cycles;
+    }
+
+    /*
+     * Backpressure signal for senders: the backlog is
+     * above 3/4 of its capacity, stop queueing new data.
+     */
+    bool tx_full(uint16_t qid) const
+    {
+        return tx[qid].size() >= pkt_queue::capacity() / 4 * 3;
+    }
     void print_stat(size_t rootx, size_t rooty) const;
+    size_t stat_lines() const { return (is_vlan() ? 1 : 3) + addrs.size(); }
+    void print_addrs() const;
 
     void ioctl(uint64_t request, void* arg);
 
 private:
     void ioctl_siocsifaddr(const stcp_ifreq* ifr);
+    void ioctl_siocaifaddr(const stcp_ifreq* ifr);
+    void ioctl_siocdifaddr(const stcp_ifreq* ifr);
     void ioctl_siocgifaddr(stcp_ifreq* ifr);
     void ioctl_siocsifhwaddr(const stcp_ifreq* ifr);
     void ioctl_siocgifhwaddr(stcp_ifreq* ifr);
@@ -64,10 +160,7 @@ private:
     void ioctl_siocpromisc(const uint64_t* val);
 
 public:
-    void rx_push(mbuf* msg) { rx.push(msg); }
-    void tx_push(mbuf* msg) { tx.push(msg); }
-    mbuf* rx_pop() { return rx.pop(); }
-    mbuf* tx_pop() { return tx.pop(); }
+    void tx_push(uint16_t qid, mbuf* msg);
 };
 
 
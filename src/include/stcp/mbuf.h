@@ -2,6 +2,7 @@
 #pragma once
 
 #include <stdint.h>
+#include <algorithm>
 #include <stddef.h>
 #include <stcp/stcp.h>
 #include <stcp/config.h>
@@ -52,6 +53,70 @@ inline void mbuf_trim(mbuf* m, uint16_t len)
     rte::pktmbuf_trim(m, len);
 }
 
+/*
+ * Appends tail's segments to the end of head's chain.
+ */
+inline void mbuf_chain(mbuf* head, mbuf* tail)
+{
+    mbuf* last = head;
+    while (last->next != nullptr) {
+        last = last->next;
+    }
+    last->next     = tail;
+    head->nb_segs += tail->nb_segs;
+    head->pkt_len += tail->pkt_len;
+}
+
+/*
+ * Keeps only the first len bytes of msg,
+ * freeing segments that end up empty.
+ */
+inline void mbuf_truncate(mbuf* msg, size_t len)
+{
+    mbuf* seg = msg;
+    size_t remain = len;
+    uint8_t nb_segs = 1;
+    while (seg->data_len < remain) {
+        remain -= seg->data_len;
+        seg = seg->next;
+        nb_segs++;
+    }
+    seg->data_len = remain;
+    if (seg->next != nullptr) {
+        rte::pktmbuf_free(seg->next);
+        seg->next = nullptr;
+    }
+    msg->nb_segs = nb_segs;
+    msg->pkt_len = len;
+}
+
+/*
+ * Returns a chain of indirect mbufs from mp that refer to
+ * bytes [off, off+len) of msg. No payload is copied.
+ */
+inline mbuf* mbuf_slice(mbuf* msg, size_t off, size_t len, mempool* mp)
+{
+    mbuf* head = nullptr;
+    for (mbuf* seg=msg; seg!=nullptr && len>0; seg=seg->next) {
+        if (off >= seg->data_len) {
+            off -= seg->data_len;
+            continue;
+        }
+        uint16_t n = std::min<size_t>(seg->data_len - off, len);
+        mbuf* mi = rte::pktmbuf_alloc(mp);
+        rte::pktmbuf_attach(mi, seg);
+        mi->data_off += off;
+        mi->data_len  = n;
+        mi->pkt_len   = n;
+
+        if (head == nullptr) head = mi;
+        else mbuf_chain(head, mi);
+        len -= n;
+        off  = 0;
+    }
+    return head;
+}
+
 inline void mbuf_dump(FILE* f, const mbuf* m, unsigned dump_len)
 {
     rte::pktmbuf_dump(f, m, dump_len);
@@ -3,8 +3,11 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <string.h>
+#include <string>
 #include <stcp/config.h>
 #include <stcp/debug.h>
+#include <stcp/exception.h>
 
 namespace stcp {
 
@@ -43,4 +46,50 @@ inline uint32_t pool_size(mempool* mp)
 }
 
 
+/*
+ * One pool per NUMA node in node_mask.
+ * local() picks the pool of the calling lcore's node.
+ */
+class numa_pools {
+    mempool* mp[RTE_MAX_NUMA_NODES];
+public:
+    numa_pools() { memset(mp, 0, sizeof mp); }
+
+    void create(const char* name, unsigned n, unsigned cache_size,
+            uint16_t data_room_size, uint32_t node_mask)
+    {
+        for (int node=0; node<RTE_MAX_NUMA_NODES; node++) {
+            if ((node_mask & (1u << node)) == 0)
+                continue;
+            std::string s = std::string(name) + " " + std::to_string(node);
+            mp[node] = pool_create(s.c_str(), n, cache_size, data_room_size, node);
+        }
+    }
+
+    mempool* on(int node) const
+    {
+        if (0 <= node && node < RTE_MAX_NUMA_NODES && mp[node] != nullptr)
+            return mp[node];
+        for (mempool* p : mp) {
+            if (p != nullptr) return p;
+        }
+        throw exception("numa_pools: no pool created");
+    }
+    mempool* local() const { return on(rte::socket_id()); }
+
+    uint32_t use_count() const
+    {
+        uint32_t n = 0;
+        for (mempool* p : mp) if (p != nullptr) n += pool_use_count(p);
+        return n;
+    }
+    uint32_t size() const
+    {
+        uint32_t n = 0;
+        for (mempool* p : mp) if (p != nullptr) n += pool_size(p);
+        return n;
+    }
+};
+
+
 } /* namespace stcp */
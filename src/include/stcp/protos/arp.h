@@ -7,10 +7,11 @@
 #include <string.h>
 #include <stdint.h>
 #include <stddef.h>
-#include <queue>
 
 #include <stcp/config.h>
 #include <stcp/socket.h>
+#include <stcp/mempool.h>
+#include <stcp/protos/ethernet.h>
 
 
 namespace stcp {
@@ -71,41 +72,92 @@ public:
 
 
 
-struct wait_ent {
-    uint8_t port;
-    mbuf* msg;
-    stcp_sockaddr dst;
-    wait_ent(uint8_t p, mbuf* m, stcp_sockaddr d) :
-        port(p), msg(m), dst(d) {}
+/*
+ * Neighbor cache states, after RFC 4861 7.3.2
+ * without DELAY: a STALE entry is probed on next use.
+ */
+enum arp_state : uint8_t {
+    ARPS_FREE = 0,
+    ARPS_INCOMPLETE, /* request sent, no reply yet            */
+    ARPS_REACHABLE,  /* confirmed within ST_ARP_REACHABLE_MS  */
+    ARPS_STALE,      /* usable, reconfirmed on next use       */
+    ARPS_PROBE,      /* usable, unicast request outstanding   */
+    ARPS_PERMANENT,  /* added by ioctl, never ages            */
 };
 
 
+/*
+ * Neighbor cache entry, one cache line each,
+ * keyed on (port, pa) in arp_module's open-addressing table.
+ *
+ * l2_hdr is the IPv4 ethernet header towards this neighbor,
+ * 2 bytes of padding first so that it is stored with one
+ * 16-byte move ending at the ip header. On a software-tagged
+ * vlan it is dst, src and the 802.1Q tag instead.
+ */
+struct alignas(RTE_CACHE_LINE_SIZE) arp_entry {
+    stcp_in_addr    pa;
+    uint8_t         port;
+    uint8_t         state;
+    uint8_t         probes;    /* requests sent in INCOMPLETE/PROBE */
+    bool            l2_valid;  /* l2_hdr matches ha and port mac    */
+    stcp_ether_addr ha;
+    uint16_t        nb_pending;
+    uint64_t        confirmed; /* tsc of last reply                 */
+    uint64_t        probed;    /* tsc of last request               */
+    mbuf*           pending_head; /* frames waiting for INCOMPLETE, */
+    mbuf*           pending_tail; /* linked through mbuf userdata   */
+    uint8_t         l2_hdr[16] __attribute__((aligned(16)));
+};
+static_assert(sizeof(arp_entry) == RTE_CACHE_LINE_SIZE, "arp_entry spans cache lines");
+
+
 
 class arp_module {
 private:
     bool use_dynamic_arp;
 private:
-    std::vector<stcp_arpreq> table;
-    mempool* mp;
-
-public:
-    std::queue<wait_ent> arpresolv_wait_queue;
+    arp_entry* table;      /* linear probing, table_mask+1 slots */
+    uint32_t   table_mask;
+    size_t     nb_entries;
+    uint32_t   gc_pos;
+    uint64_t   reachable_cycles;
+    uint64_t   retrans_cycles;
+    uint64_t   gc_stale_cycles;
+    size_t     nb_pending;
+    size_t     pending_drops;
+    std::vector<stcp_arpreq> table_snapshot; /* for SIOCGARPENT */
+    numa_pools pools;
 
 public:
-    arp_module() : use_dynamic_arp(true), mp(nullptr) {}
+    arp_module() : use_dynamic_arp(true), table(nullptr), table_mask(0),
+        nb_entries(0), gc_pos(0), reachable_cycles(0), retrans_cycles(0),
+        gc_stale_cycles(0), nb_pending(0), pending_drops(0) {}
     void init();
     void rx_push(mbuf* msg);
     void tx_push(mbuf* msg);
-
-    /*
-     * TODO reimplement smartly
-     */
-    bool arp_resolv(uint8_t port, const stcp_sockaddr *dst,
-            stcp_ether_addr* dsten, bool checkcacheonly=false);
-    void arp_request(uint8_t port, const stcp_in_addr* tip);
+    void proc();
+
+    const arp_entry* arp_resolv(uint8_t port, const stcp_sockaddr *dst);
+    void l2_invalidate(uint8_t port);
+    void l2_cache_fill(const arp_entry* e, ether_l2_cache* l2c) const;
+    void arp_pending(uint8_t port, const stcp_sockaddr *dst, mbuf* msg);
+    void arp_request(uint8_t port, const stcp_in_addr* tip,
+            const stcp_ether_addr* tha=nullptr);
     void ioctl(uint64_t request, void* arg);
     void print_stat() const;
 
+private:
+    uint32_t   slot(uint8_t port, const stcp_in_addr& pa) const;
+    arp_entry* lookup(uint8_t port, const stcp_in_addr& pa);
+    arp_entry* insert(uint8_t port, const stcp_in_addr& pa);
+    void       erase(arp_entry* e);
+    void       pending_free(arp_entry* e);
+    void       pending_flush(arp_entry* e);
+    void       l2_build(arp_entry* e);
+    void       confirm(uint8_t port, const stcp_in_addr& pa,
+                    const stcp_ether_addr& ha, bool create);
+
 private:
     void ioctl_siocaarpent(stcp_arpreq* req);
     void ioctl_siocdarpent(stcp_arpreq* req);
@@ -20,10 +20,30 @@ struct stcp_ether_header {
     uint16_t type;
 };
 
+/*
+ * 802.1Q tag following the source address.
+ */
+struct stcp_vlan_header {
+    uint16_t tci;  /* pcp:3 dei:1 vid:12 */
+    uint16_t type;
+};
+
+/*
+ * Copy of a neighbor's l2 header held in a socket's
+ * ip_dst_cache, used without asking arp until expire.
+ */
+struct ether_l2_cache {
+    uint8_t  hdr[16] __attribute__((aligned(16))); /* as arp_entry::l2_hdr */
+    uint64_t expire;                              /* tsc, 0 when invalid */
+
+    ether_l2_cache() : expire(0) {}
+};
+
 enum stcp_ether_type : uint16_t {
     ETHERTYPE_IP     = 0x0800,
     ETHERTYPE_ARP    = 0x0806,
     ETHERTYPE_REVARP = 0x8035,
+    ETHERTYPE_VLAN   = 0x8100,
 };
 
 
@@ -31,11 +51,14 @@ class ether_module {
 private:
 
 public:
-    ether_module() {}
+    size_t rx_vlan_unknown; /* tagged with a vid we have no interface for */
+
+    ether_module() : rx_vlan_unknown(0) {}
 
-    void rx_push(mbuf* msg);
-    void tx_push(uint8_t port, mbuf* msg, const stcp_sockaddr* dst);
-    void proc();
+    void rx_push(mbuf* msg) { rx_burst(&msg, 1); }
+    void rx_burst(mbuf** msgs, uint16_t nb_msgs);
+    void tx_push(uint8_t port, mbuf* msg, const stcp_sockaddr* dst,
+            ether_l2_cache* l2c=nullptr);
 };
 
 
@@ -68,7 +68,7 @@ private:
 public:
     icmp_module() {}
 
-    void rx_push(mbuf* msg, const stcp_sockaddr_in* src);
+    void rx_push(mbuf* msg, const stcp_sockaddr_in* src, const stcp_in_addr* dst);
     void send_err(icmp_type type, icmp_code code,
             const stcp_sockaddr_in* dst, mbuf* msg);
     void print_stat() const;
@@ -6,6 +6,7 @@
 #include <stcp/util.h>
 #include <stcp/tuning.h>
 #include <stcp/debug.h>
+#include <stcp/protos/ethernet.h>
 
 
 
@@ -84,6 +85,62 @@ struct stcp_rtentry {
 
 
 
+/*
+ * FIB next hop, indexed by the rte_lpm next-hop id.
+ * A zero gateway means on-link, the destination itself.
+ */
+struct ip_nexthop {
+    stcp_in_addr gateway;
+    uint8_t      port;
+};
+
+
+
+/*
+ * What a socket needs to send to one destination,
+ * filled by ip_module::dst_resolv() and trusted while
+ * gen equals ip_module's, which is bumped whenever a
+ * route, an interface address or a neighbor changes.
+ */
+struct ip_dst_cache {
+    uint64_t          gen;        /* 0: never filled              */
+    stcp_in_addr      dst;
+    stcp_in_addr      laddr;      /* owner's bound address or 0   */
+    stcp_in_addr      src;        /* source address to use        */
+    stcp_sockaddr_in  next;       /* next hop, dst or its gateway */
+    uint8_t           port;       /* egress interface             */
+    uint16_t          mtu;
+    uint32_t          tx_offload; /* DEV_TX_OFFLOAD_* of port     */
+    ether_l2_cache    l2;
+
+    ip_dst_cache() : gen(0), laddr(stcp_in_addr::zero), port(0), mtu(0), tx_offload(0) {}
+};
+
+
+
+/*
+ * Slot of the local address set.
+ */
+struct ip_local_ent {
+    stcp_in_addr addr;
+    uint8_t      port;
+    bool         used;
+};
+
+
+
+/*
+ * IP identification counter of one lcore, padded so that
+ * lcores never share a line. Each starts at a random
+ * offset, so ids repeat only after 64k datagrams from
+ * the same lcore.
+ */
+struct alignas(RTE_CACHE_LINE_SIZE) ip_id_counter {
+    uint16_t next;
+};
+
+
+
 enum ip_l4_protos : uint8_t {
     STCP_IPPROTO_ICMP = 0x01,
     STCP_IPPROTO_TCP  = 0x06,
@@ -98,26 +155,92 @@ private:
     static const uint8_t ttl_default      = 0x40;
     static const size_t  num_max_fragment = 10;
     size_t not_to_me;
-    stcp_in_addr myip;
+    size_t cksum_err;
+    size_t tx_direct;    /* sent without the fragmenter */
+    size_t tx_frags;     /* fragments sent              */
+    size_t tx_frag_err;  /* datagrams the fragmenter lost */
+
+    /*
+     * Every inet address of every interface, hashed for the
+     * rx check, and each port's primary for source selection.
+     * Both are rebuilt by ifaddr_changed().
+     */
+    std::vector<ip_local_ent> local_tbl;
+    uint32_t                  local_mask;
+    std::vector<stcp_in_addr> port_src;   /* zero: port has none */
+    stcp_in_addr              any_src;    /* first address found */
     ip_frag_death_row  dr;
     ip_frag_tbl*       frag_tbl;
 
+    /*
+     * Reassembly accounting. Fragments are stamped with their
+     * arrival tsc in udata64, so that those coming back on the
+     * death row tell a timeout from an eviction or a bad one.
+     */
+    uint64_t frag_timeout_cycles;
+    uint32_t frag_held;                          /* mbufs in frag_tbl   */
+    uint16_t frag_src_held[ST_IPFRAG_SRC_SLOTS]; /* same, by src hash   */
+    size_t   frag_done;       /* datagrams reassembled             */
+    size_t   frag_timedout;   /* fragments freed after the timeout */
+    size_t   frag_evicted;    /* freed earlier: no room, malformed */
+    size_t   frag_limited;    /* refused by the memory limits      */
+
+    /*
+     * Routes are kept in rttable for ioctl and display,
+     * lookups go to the LPM built from it plus the
+     * connected prefixes of every interface.
+     * rte_lpm has no /0, the default route sits aside.
+     */
+    static const uint32_t no_nexthop = UINT32_MAX;
+    struct rte_lpm*          fib;
+    std::vector<ip_nexthop>  nexthops;
+    uint32_t                 default_nh;
+    uint64_t                 dst_gen;   /* see ip_dst_cache */
+
+    ip_id_counter ip_ids[RTE_MAX_LCORE + 1]; /* last one for non-EAL threads */
+
 public:
-    mempool* direct_pool;
-    mempool* indirect_pool;
+    numa_pools direct_pools;
+    numa_pools indirect_pools;
     std::vector<stcp_rtentry> rttable;
 
-    ip_module() : not_to_me(0),
-            direct_pool(nullptr), indirect_pool(nullptr) {}
+    ip_module() : not_to_me(0), cksum_err(0),
+            tx_direct(0), tx_frags(0), tx_frag_err(0), local_mask(0),
+            frag_tbl(nullptr), frag_timeout_cycles(0), frag_held(0),
+            frag_done(0), frag_timedout(0), frag_evicted(0), frag_limited(0),
+            fib(nullptr), default_nh(no_nexthop), dst_gen(1)
+    { memset(frag_src_held, 0, sizeof frag_src_held); }
     void init();
+    mempool* direct_pool() const { return direct_pools.local(); }
+    mempool* indirect_pool() const { return indirect_pools.local(); }
 
-    void set_ipaddr(const stcp_in_addr* addr);
-    void rx_push(mbuf* msg);
-    void tx_push(mbuf* msg, const stcp_sockaddr_in* dst, ip_l4_protos proto);
+    void ifaddr_changed();
+    bool is_local(const stcp_in_addr& addr) const;
+    void rx_push(mbuf* msg) { rx_burst(&msg, 1); }
+    void rx_burst(mbuf** msgs, uint16_t nb_msgs);
+    void tx_push(mbuf* msg, const stcp_sockaddr_in* dst, ip_l4_protos proto,
+            ip_dst_cache* dc=nullptr);
 
     void ioctl(uint64_t request, void* args);
     void route_resolv(const stcp_sockaddr_in* dst, stcp_sockaddr_in* next, uint8_t* port);
+    void fib_rebuild();
+    void dst_resolv(ip_dst_cache* dc, const stcp_sockaddr_in* dst);
+    void dst_invalidate() { dst_gen++; }
+
+    /*
+     * Next IP id of the calling lcore, network byte order.
+     */
+    uint16_t next_ip_id()
+    {
+        unsigned lcore = rte::lcore_id();
+        if (unlikely(lcore >= RTE_MAX_LCORE))
+            lcore = RTE_MAX_LCORE;
+        return hton16(ip_ids[lcore].next++);
+    }
+    bool tx_throttled(const stcp_sockaddr_in* dst, ip_dst_cache* dc=nullptr);
+    uint32_t tx_offload_capa(const stcp_sockaddr_in* dst, ip_dst_cache* dc=nullptr);
     void print_stat() const;
+    void proc();
 
 private:
     void ioctl_siocaddrt(const stcp_rtentry* rt);
@@ -126,7 +249,23 @@ private:
     void ioctl_siocgetrts(std::vector<stcp_rtentry>** table);
 
 private:
-    bool is_linklocal(uint8_t port, const stcp_sockaddr_in* addr);
+    bool if_inaddr(uint8_t port, stcp_in_addr* addr, stcp_in_addr* mask) const;
+    void local_rebuild();
+    stcp_in_addr src_select(const ip_dst_cache* dc) const;
+    uint32_t nexthop_id(const stcp_in_addr& gw, uint8_t port);
+    void fib_insert(const stcp_in_addr& dst, uint8_t depth,
+            const stcp_in_addr& gw, uint8_t port);
+    void fib_insert(const stcp_rtentry& rt);
+    mbuf* rx_input(mbuf* msg);
+    mbuf* rx_reassemble(mbuf* msg, stcp_ip_header* ih);
+    void  frag_release(const stcp_in_addr& src, uint32_t n);
+    void  frag_free_death_row();
+    void  frag_expire();
+    bool rx_ip_cksum_ok(const mbuf* msg, const stcp_ip_header* ih) const;
+    bool rx_l4_cksum_ok(const mbuf* msg, const stcp_ip_header* ih) const;
+    void tx_ip_cksum(mbuf* msg, uint32_t tx_offload);
+    void tx_l4_cksum(mbuf* msg, stcp_ip_header* ih,
+            ip_l4_protos proto, uint32_t tx_offload);
 };
 
 
@@ -19,6 +19,16 @@ namespace stcp {
 
 
 
+/*
+ * Key of the connection table. Must be zero cleared
+ * before filled, it is hashed as raw bytes.
+ */
+struct tcp_conn_key {
+    stcp_in_addr laddr;
+    stcp_in_addr raddr;
+    uint16_t     lport; /* NetworkByteOrder */
+    uint16_t     rport; /* NetworkByteOrder */
+};
 
 
 class tcp_module {
@@ -26,17 +36,67 @@ class tcp_module {
     friend class stcp_tcp_sock;
 private:
     static size_t mss;
-    mempool* mp;
-    std::vector<stcp_tcp_sock> socks;
+    numa_pools pools;
+
+    /*
+     * Socket pool. Slabs are constructed when needed and never
+     * released, so socket pointers stay valid. Free sockets are
+     * on free_socks, used ones are linked from used_head.
+     */
+    std::vector<stcp_tcp_sock*> slabs;
+    std::vector<stcp_tcp_sock*> free_socks;
+    stcp_tcp_sock* used_head;
+    size_t nb_socks;    /* constructed */
+    size_t nb_used;
+    size_t max_socks;
+    work_list<stcp_tcp_sock> tx_work; /* sockets with txq to send */
+    stcp_tcp_sock* timer_head;        /* sockets with the RTO armed */
+    uint64_t timer_next_check;        /* tsc */
+
+    struct rte_hash* conns;                /* 4-tuple -> connected sock   */
+    std::vector<stcp_tcp_sock*> listeners; /* local port -> listening sock */
+    size_t nb_conns;
+    size_t rx_nosock;
+    size_t rx_ooo;      /* past rcv_nxt, dropped */
+    size_t rx_syn_drop; /* backlog, pool or connection table full */
+    size_t gro_merged;
+    size_t tso_sent;
+    size_t gso_segs;
+    size_t rtx_timeouts;
+    size_t rtx_fast;
+    size_t rtx_aborts;
 
 public:
-    tcp_module() : mp(nullptr), socks(ST_NB_TCPSOCKET_ALLOC) {}
+    tcp_module() : used_head(nullptr), nb_socks(0), nb_used(0),
+        max_socks(ST_NB_TCPSOCKET_ALLOC),
+        timer_head(nullptr), timer_next_check(0), conns(nullptr),
+        listeners(65536, nullptr), nb_conns(0), rx_nosock(0), rx_ooo(0), rx_syn_drop(0),
+        gro_merged(0), tso_sent(0), gso_segs(0),
+        rtx_timeouts(0), rtx_fast(0), rtx_aborts(0) {}
     void init();
+    stcp_tcp_sock* sock_alloc();
+    stcp_tcp_sock* sock_try_alloc();
+    void sock_free(stcp_tcp_sock* sock);
+    mempool* pool() const { return pools.local(); }
     void rx_push(mbuf* msg, stcp_sockaddr_in* src);
-    void tx_push(mbuf* msg, const stcp_sockaddr_in* dst);
+    void rx_burst(mbuf** msgs, stcp_sockaddr_in* srcs, uint16_t nb_msgs);
+    void tx_push(mbuf* msg, const stcp_sockaddr_in* dst, ip_dst_cache* dc=nullptr);
 
     void proc();
     void print_stat() const;
+
+private:
+    bool slab_grow();
+    void timer_insert(stcp_tcp_sock* sock);
+    void timer_erase(stcp_tcp_sock* sock);
+    void timer_proc();
+    uint16_t rx_gro(mbuf** msgs, stcp_sockaddr_in* srcs, uint16_t nb_msgs);
+    stcp_tcp_sock* sock_lookup(const stcp_in_addr& laddr, uint16_t lport,
+            const stcp_in_addr& raddr, uint16_t rport);
+    bool conn_insert(stcp_tcp_sock* sock);
+    void conn_erase(stcp_tcp_sock* sock);
+    void listen_insert(stcp_tcp_sock* sock);
+    void listen_erase(stcp_tcp_sock* sock);
 };
 
 
@@ -10,6 +10,7 @@
 #include <stcp/protos/tcp_var.h>
 #include <stcp/protos/tcp.h>
 #include <vector>
+#include <atomic>
 
 
 
@@ -29,30 +30,97 @@ public:
      */
     bool readable()   { return !rxq.empty(); }
     bool acceptable() { return wait_accept_count > 0; }
-    bool sockdead()   { return sock_state==SOCKS_UNUSE; }
+    bool sockdead()   { return sock_state==SOCKS_DEAD; }
 
 private:
+    /*
+     * Children of a listener, linked through child_prev/next.
+     * Touched under stack_lock.
+     */
+    struct child_list {
+        stcp_tcp_sock* head;
+        stcp_tcp_sock* tail;
+        size_t         size;
+
+        child_list() : head(nullptr), tail(nullptr), size(0) {}
+        bool empty() const { return head == nullptr; }
+        void push_back(stcp_tcp_sock* s);
+        void erase(stcp_tcp_sock* s);
+    };
+
     stcp_tcp_sock* parent;
+    stcp_tcp_sock* child_prev;
+    stcp_tcp_sock* child_next;
+    stcp_tcp_sock* used_prev; /* tcp_module used list */
+    stcp_tcp_sock* used_next;
 
-    queue_TS<mbuf*> rxq;
-    queue_TS<mbuf*> txq;
+    mbuf_queue_TS rxq;
+    mbuf_queue_TS txq;
 
-    size_t wait_accept_count;
+    /*
+     * Half-open children are on synq, they do not count against
+     * the backlog. Established ones wait on acceptq, oldest first,
+     * wait_accept_count is its size for accept() to read before
+     * it takes stack_lock.
+     */
+    child_list synq;
+    child_list acceptq;
+    std::atomic<size_t> wait_accept_count;
     size_t max_connect;
 
 private:
     socketstate sock_state;
     tcpstate    tcp_state;
+    bool        hashed;    /* in tcp_module conns or listeners */
+    std::atomic<bool> tx_pending; /* on tcp_module tx_work */
     uint16_t port;      /* NetworkByteOrder */
     uint16_t pair_port; /* NetworkByteOrder */
     stcp_sockaddr_in addr;
     stcp_sockaddr_in pair;
+    ip_dst_cache     dst_cache; /* route and neighbor towards pair */
     tcp_stream_info si;
 
+private:
+    /*
+     * Retransmission, RFC 6298. rtxq holds written mbufs
+     * (payload only) until acked, every send refers to them
+     * through indirect mbufs. The first one starts at rtx_seq,
+     * a SYN or FIN sent after them is kept as rtx_ctl. As BSD
+     * does, one segment at a time is timed for RTT, none once
+     * anything is resent (Karn). Touched by the stack only.
+     */
+    mbuf_list rtxq;
+    uint32_t rtx_seq;     /* HostByteOrder                 */
+    uint8_t  rtx_ctl;     /* flags of the SYN/FIN, or 0    */
+    uint32_t rtt_seq;     /* HostByteOrder                 */
+    uint64_t rtt_start;   /* tsc, 0 when nothing is timed  */
+    uint32_t srtt;        /* us, 0 before the first sample */
+    uint32_t rttvar;      /* us                            */
+    uint32_t rto;         /* us                            */
+    uint64_t rto_expire;  /* tsc, 0 when the timer is off  */
+    uint32_t nb_timeouts; /* in a row                      */
+    uint32_t dupacks;
+    stcp_tcp_sock* timer_prev; /* tcp_module timer list */
+    stcp_tcp_sock* timer_next;
+
 private:
     void proc();
+    void tx_kick();
+    void accept_ready(stcp_tcp_sock* child);
+    void accept_drop(stcp_tcp_sock* child, bool established);
     void print_stat(size_t rootx, size_t rooty) const;
     void rx_push(mbuf* msg, stcp_sockaddr_in* src);
+    void tx_seg(mbuf* payload, uint32_t seq, size_t off, size_t len);
+    void hdr_fill(tcpip* tih, uint32_t seq, uint8_t flags, size_t dlen,
+            const stcp_sockaddr_in* dst) const;
+    void rto_arm();
+    void rto_disarm();
+    void rtt_sample(uint64_t cycles);
+    bool rtx_empty() const { return rtxq.empty() && rtx_ctl == 0; }
+    void rtx_acked(uint32_t ack);
+    void rtx_dupack();
+    void rtx_head();
+    void rtx_timeout();
 
 public:
     void init();
@@ -94,12 +162,17 @@ private:
     void rx_push_SYN_SEND(mbuf* msg, stcp_sockaddr_in* src);
     void rx_push_ELSESTATE(mbuf* msg, stcp_sockaddr_in* src);
 
-    bool rx_push_ES_seqchk(mbuf* msg, stcp_sockaddr_in* src);
-    bool rx_push_ES_rstchk(mbuf* msg, stcp_sockaddr_in* src);
-    bool rx_push_ES_synchk(mbuf* msg, stcp_sockaddr_in* src);
-    bool rx_push_ES_ackchk(mbuf* msg, stcp_sockaddr_in* src);
-    bool rx_push_ES_textseg(mbuf* msg, stcp_sockaddr_in* src);
-    bool rx_push_ES_finchk(mbuf* msg, stcp_sockaddr_in* src);
+    bool rx_push_ES_seqchk(mbuf*& msg, const tcp_seg& seg, stcp_sockaddr_in* src);
+    bool rx_push_ES_rstchk(mbuf*& msg, const tcp_seg& seg, stcp_sockaddr_in* src);
+    bool rx_push_ES_synchk(mbuf*& msg, const tcp_seg& seg, stcp_sockaddr_in* src);
+    bool rx_push_ES_ackchk(mbuf*& msg, const tcp_seg& seg, stcp_sockaddr_in* src);
+    bool rx_push_ES_textseg(mbuf*& msg, const tcp_seg& seg, stcp_sockaddr_in* src);
+    bool rx_push_ES_finchk(mbuf*& msg, const tcp_seg& seg, stcp_sockaddr_in* src);
+
+    void tx_ctl(uint8_t flags, const stcp_sockaddr_in* dst);
+    void tx_ctl(uint8_t flags, const stcp_sockaddr_in* dst, uint32_t seq);
+    void tx_ctl_rtx(uint8_t flags);
+    void tx_rst(mbuf*& msg, const tcp_seg& seg, stcp_sockaddr_in* src);
 };
 
 
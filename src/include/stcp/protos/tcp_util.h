@@ -45,6 +45,12 @@ inline void swap_port(tcpip* tih)
     tih->tcp.sport = tih->tcp.dport;
     tih->tcp.dport = tmp;
 }
+/*
+ * Sequence number comparison modulo 2^32.
+ */
+inline bool seq_lt(uint32_t a, uint32_t b) { return int32_t(a - b) <  0; }
+inline bool seq_le(uint32_t a, uint32_t b) { return int32_t(a - b) <= 0; }
+inline bool seq_gt(uint32_t a, uint32_t b) { return int32_t(a - b) >  0; }
 inline bool HAVE(tcpip* tih, tcpflag type)
 {
     return ((tih->tcp.flags & type) != 0x00);
@@ -72,6 +78,7 @@ inline const char* sockstate2str(socketstate state)
         case SOCKS_USE :    return "USE";
         case SOCKS_UNUSE:   return "UNUSE";
         case SOCKS_WAITACCEPT: return "WAITACCEPT";
+        case SOCKS_DEAD:    return "DEAD";
         default:            return "UNKNOWN";
     }
 }
@@ -30,6 +30,7 @@ enum socketstate {
     SOCKS_USE,
     SOCKS_UNUSE,
     SOCKS_WAITACCEPT,
+    SOCKS_DEAD,       /* closed, kept until destroy_tcp_socket() */
 };
 
 enum tcpstate {
@@ -84,6 +85,34 @@ struct tcpip {
 };
 
 
+/*
+ * Fields of an arrived segment read by the
+ * state machine, parsed once. HostByteOrder.
+ */
+struct tcp_seg {
+    uint32_t seq;
+    uint32_t ack;
+    uint16_t win;
+    uint16_t dlen;  /* payload length        */
+    uint16_t hlen;  /* ip and tcp header len */
+    uint8_t  flags;
+
+    explicit tcp_seg(const tcpip* tih)
+    {
+        uint16_t iptotlen = ntoh16(tih->ip.total_length);
+        uint16_t iphlen   = (tih->ip.version_ihl & 0x0f)<<2;
+        uint16_t tcphlen  = (tih->tcp.data_off>>4)<<2;
+        seq   = ntoh32(tih->tcp.seq);
+        ack   = ntoh32(tih->tcp.ack);
+        win   = ntoh16(tih->tcp.rx_win);
+        dlen  = iptotlen - iphlen - tcphlen;
+        hlen  = sizeof(stcp_ip_header) + tcphlen;
+        flags = tih->tcp.flags;
+    }
+    bool has(tcpflag f) const { return (flags & f) != 0; }
+};
+
+
 #if 0
 enum tcp_op_number : uint8_t {
     TCP_OP_FIN = 0x00,
@@ -6,10 +6,12 @@
 #include <stcp/dataplane.h>
 #include <stcp/util.h>
 #include <stcp/debug.h>
+#include <stcp/protos/ip.h>
 
 #include <vector>
 #include <queue>
 #include <mutex>
+#include <atomic>
 
 
 namespace stcp {
@@ -53,10 +55,13 @@ private:
     queue_TS<stcp_udp_sockdata> txq; /* transmission queue    */
     uint16_t port;         /* stored as NwByteOrder */
     stcp_in_addr addr;     /* binded address        */
+    ip_dst_cache dst_cache; /* last destination sent to */
+    std::atomic<bool> tx_pending; /* on udp_module tx_work */
     void proc();
+    void tx_kick();
 
 public:
-    stcp_udp_sock() : state(unbind) {}
+    stcp_udp_sock() : state(unbind), tx_pending(false) {}
     bool operator==(const stcp_udp_sock& rhs) const { return port==rhs.port; }
     bool operator!=(const stcp_udp_sock& rhs) const { return !(*this==rhs); }
 
@@ -69,13 +74,17 @@ public: /* for Users Operation */
 
 class udp_module {
     friend class core;
+    friend class stcp_udp_sock;
 private:
     std::vector<stcp_udp_sock*> socks;
+    work_list<stcp_udp_sock> tx_work; /* sockets with txq to send */
 
 public:
     udp_module() {}
     void rx_push(mbuf* msg, stcp_sockaddr_in* src);
-    void tx_push(mbuf* msg, const stcp_sockaddr_in* dst, uint16_t srcp);
+    void rx_burst(mbuf** msgs, stcp_sockaddr_in* srcs, uint16_t nb_msgs);
+    void tx_push(mbuf* msg, const stcp_sockaddr_in* dst, uint16_t srcp,
+            ip_dst_cache* dc=nullptr);
     void print_stat() const;
     void proc();
 };
@@ -39,6 +39,8 @@ enum ioctl_family : uint64_t {
     STCP_SIOCSIFNETMASK,
     STCP_SIOCGIFNETMASK,
     STCP_SIOCPROMISC,
+    STCP_SIOCAIFADDR,  /* add a secondary inet address */
+    STCP_SIOCDIFADDR,  /* delete an inet address       */
 
     /* arp  */
     STCP_SIOCAARPENT,
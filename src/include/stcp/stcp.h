@@ -17,6 +17,7 @@
 #include <stcp/protos/tcp.h>
 
 #include <vector>
+#include <mutex>
 
 
 namespace stcp {
@@ -59,6 +60,7 @@ class core {
     friend class stcp_tcp_sock;
 
     friend class ifnet;
+    friend class dataplane;
     friend class ether_module;
     friend class arp_module;
     friend class ip_module;
@@ -69,6 +71,12 @@ class core {
 private:
     static std::vector<stcp_usrapp_info> lapps;
 
+    /*
+     * Serializes protocol processing between the polling lcores.
+     * Queue I/O itself is lcore-local and runs without it.
+     */
+    static std::mutex stack_lock;
+
 public:
     static stcp_tcp_sock* create_tcp_socket();
     static stcp_udp_sock* create_udp_socket();
@@ -88,6 +96,7 @@ private:
     static arp_module    arp;
     static ether_module  ether;
     static dataplane     dplane;
+    static tuning_params tune;
 
 public:
     static void init(int argc, char** argv);
@@ -97,7 +106,8 @@ public:
 #endif
 
 private:
-    static void ifs_proc();
+    static void ifs_proc(uint16_t qid);
+    static int  queue_loop(void* arg);
     static void stat_all();
 
 public:
@@ -118,7 +128,20 @@ public:
             uint8_t o4, uint8_t o5, uint8_t o6);
     static void set_ip_addr(
             uint8_t o1, uint8_t o2, uint8_t o3,
-            uint8_t o4, uint8_t cidr);
+            uint8_t o4, uint8_t cidr, uint8_t port=0);
+
+    /*
+     * Secondary address on ifindex port, accepted on rx
+     * and used as source by sockets bound to it.
+     */
+    static void add_ip_addr(
+            uint8_t o1, uint8_t o2, uint8_t o3,
+            uint8_t o4, uint8_t port=0);
+    /*
+     * 802.1Q sub-interface vid on physical port, returns
+     * the ifindex to pass to set_ip_addr() and routes.
+     */
+    static uint8_t add_vlan(uint8_t port, uint16_t vid);
     static void add_arp_record(
             uint8_t o1, uint8_t o2, uint8_t o3, uint8_t o4,
             uint8_t ho1, uint8_t ho2, uint8_t ho3,
@@ -23,12 +23,88 @@ namespace stcp {
 // #define ETHER_CRC_LEN
 #define ST_ETHER_MTU 1500
 
-#define ST_NB_TCPSOCKET_ALLOC 5
+#define ST_NB_TCPSOCKET_ALLOC 65536 // max TCP sockets, up to some millions
+#define ST_TCP_SOCK_SLAB      1024  // sockets constructed at once when the pool grows
+#define ST_TCP_RTO_INIT_MS    1000  // RFC 6298 initial RTO
+#define ST_TCP_RTO_MIN_MS     200   // RFC 6298 says 1s, common stacks use 200ms
+#define ST_TCP_RTO_MAX_MS     60000
+#define ST_TCP_RTX_MAX        12    // timeouts in a row before the connection is dropped
+#define ST_TCP_SYNACK_MAX     5     // SYN-ACK timeouts before a half-open connection is dropped
+#define ST_NB_RXTX_QUEUES     1 // RSS queues per port, one polling lcore each
+#define ST_PKTQUEUE_SIZE   1024 // ifnet tx ring per queue, power of 2
+#define ST_TX_DRAIN_US      100 // flush a partial tx burst after this
 #define ST_MBUF_BUFSIZ 2176 // include headroom
 
 #define ST_IPFRAG_NB_BUCKETS         0x1000
 #define ST_IPFRAG_NB_ENT_PER_BUCKET  16
 #define ST_IPFRAG_MAX_ENT_PER_BUCKET 0x1000
+#define ST_IPFRAG_TIMEOUT_MS         1000 // incomplete datagrams are dropped after this
+#define ST_IPFRAG_MAX_FRAGS          2048 // fragment mbufs held by reassembly, all sources
+#define ST_IPFRAG_MAX_FRAGS_PER_SRC  256  // same, per source address hash slot
+#define ST_IPFRAG_SRC_SLOTS          1024 // source hash slots, power of 2
+
+#define ST_IP_FIB_MAX_RULES 65536 // routes the LPM holds, default route aside
+#define ST_IP_FIB_NB_TBL8   1024  // /24 blocks holding prefixes longer than /24
+
+#define ST_ARP_TABLE_SIZE   4096   // neighbor cache slots, power of 2
+#define ST_ARP_REACHABLE_MS 30000  // REACHABLE -> STALE
+#define ST_ARP_RETRANS_MS   1000   // between requests to one neighbor
+#define ST_ARP_MAX_PROBES   3      // unanswered requests before drop
+#define ST_ARP_GC_STALE_MS  600000 // STALE entries unused this long go
+#define ST_ARP_GC_STEP      32     // slots swept per arp_module::proc()
+#define ST_ARP_PENDING_MAX  64     // frames held per unresolved neighbor
+
+#define ST_RX_RING_SIZE  128
+#define ST_TX_RING_SIZE  512
+#define ST_BURST_SIZE     64 // rx/tx burst, at most ifnet's BURST_SIZE
+#define ST_CONF_PATH "stcp.conf" // overridden by $STCP_CONF
+
+
+/*
+ * Run-time values of the knobs above, the macros are
+ * their defaults. core::init() loads them from an ini
+ * file before creating pools and queues, see tuning.cc.
+ * ST_PKTQUEUE_SIZE and ST_RUNLEVEL stay compile-time.
+ */
+struct tuning_params {
+    uint32_t dataplane_mempool_nseg = ST_DATAPLANE_MEMPOOL_NSEG;
+    uint32_t dataplane_mp_cachesiz  = ST_DATAPLANE_MP_CACHESIZ;
+    uint16_t nb_rxtx_queues         = ST_NB_RXTX_QUEUES;
+    uint16_t rx_ring_size           = ST_RX_RING_SIZE;
+    uint16_t tx_ring_size           = ST_TX_RING_SIZE;
+    uint16_t burst_size             = ST_BURST_SIZE;
+    uint32_t tx_drain_us            = ST_TX_DRAIN_US;
+    uint16_t mbuf_bufsiz            = ST_MBUF_BUFSIZ;
+
+    uint32_t arp_mempool_nseg       = ST_ARPMODULE_MEMPOOL_NSEG;
+    uint32_t arp_mp_cachesiz        = ST_ARPMODULE_MP_CACHESIZ;
+    uint32_t arp_table_size         = ST_ARP_TABLE_SIZE;
+
+    uint32_t ip_dir_mempool_nseg    = ST_IPMODULE_DIR_MEMPOOL_NSEG;
+    uint32_t ip_dir_mp_cachesiz     = ST_IPMODULE_DIR_MP_CACHESIZ;
+    uint32_t ip_ind_mempool_nseg    = ST_IPMODULE_IND_MEMPOOL_NSEG;
+    uint32_t ip_ind_mp_cachesiz     = ST_IPMODULE_IND_MP_CACHESIZ;
+    uint32_t ipfrag_nb_buckets      = ST_IPFRAG_NB_BUCKETS;
+    uint32_t ipfrag_nb_ent_per_bucket  = ST_IPFRAG_NB_ENT_PER_BUCKET;
+    uint32_t ipfrag_max_ent_per_bucket = ST_IPFRAG_MAX_ENT_PER_BUCKET;
+    uint32_t ipfrag_timeout_ms      = ST_IPFRAG_TIMEOUT_MS;
+    uint32_t ipfrag_max_frags       = ST_IPFRAG_MAX_FRAGS;
+    uint32_t ipfrag_max_frags_per_src  = ST_IPFRAG_MAX_FRAGS_PER_SRC;
+    uint32_t ip_fib_max_rules       = ST_IP_FIB_MAX_RULES;
+    uint32_t ip_fib_nb_tbl8         = ST_IP_FIB_NB_TBL8;
+
+    uint32_t tcp_mempool_nseg       = ST_TCPMODULE_MEMPOOL_NSEG;
+    uint32_t tcp_mp_cachesiz        = ST_TCPMODULE_MP_CACHESIZ;
+    uint32_t tcp_nb_socket_alloc    = ST_NB_TCPSOCKET_ALLOC;
+    uint32_t tcp_sock_slab          = ST_TCP_SOCK_SLAB;
+    uint32_t tcp_rto_init_ms        = ST_TCP_RTO_INIT_MS;
+    uint32_t tcp_rto_min_ms         = ST_TCP_RTO_MIN_MS;
+    uint32_t tcp_rto_max_ms         = ST_TCP_RTO_MAX_MS;
+    uint32_t tcp_rtx_max            = ST_TCP_RTX_MAX;
+    uint32_t tcp_synack_max         = ST_TCP_SYNACK_MAX;
+
+    void load(const char* path);
+};
 
 
 /*
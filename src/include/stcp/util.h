@@ -20,26 +20,13 @@ inline uint16_t read_as_little_endian(const void* data)
     return uint16_t(p[0]) | (uint16_t(p[1]) << 8);
 }
 
+/*
+ * rte_raw_cksum() sums 16bit words in native order
+ * and folds the carries, gcc vectorizes its inner loop.
+ */
 inline uint16_t checksum(const void* data, size_t len) noexcept
 {
-    uint32_t sum;
-    const uint8_t* data_pointer = reinterpret_cast<const uint8_t*>(data);
-
-    for (; len > 1; len-=2, data_pointer+=2) {
-        uint16_t tmp = read_as_little_endian(data_pointer);
-        sum += tmp;
-    }
-
-    if (len == 1) {
-        uint8_t tmp = *data_pointer;
-        sum += tmp;
-    }
-
-    uint16_t overflowd = sum >> 16;
-    sum = sum & 0x0000ffff;
-    sum = sum + overflowd;
-
-    return ~sum;
+    return ~rte::raw_cksum(data, len);
 }
 
 inline uint16_t timediff_ms(uint64_t before, uint64_t after)
@@ -54,6 +41,16 @@ inline uint16_t ipv4_udptcp_cksum(const stcp_ip_header* ih, const void* th)
         reinterpret_cast<const ipv4_hdr*>(ih), th);
 }
 
+/*
+ * Pseudo-header checksum to seed the L4 cksum field
+ * when the NIC computes the rest (PKT_TX_TCP/UDP_CKSUM).
+ */
+inline uint16_t ipv4_phdr_cksum(const stcp_ip_header* ih, uint64_t ol_flags)
+{
+    return rte_ipv4_phdr_cksum(
+        reinterpret_cast<const ipv4_hdr*>(ih), ol_flags);
+}
+
 inline uint16_t ipv4_cksum(const stcp_ip_header* ih)
 {
     return rte_ipv4_cksum(reinterpret_cast<const ipv4_hdr*>(ih));
@@ -132,6 +129,12 @@ inline void *memcpy (void *dst, const void *src, size_t n)
 }
 
 
+inline void prefetch0(const volatile void* p)
+{
+    rte::prefetch0(p);
+}
+
+
 inline void delay_clk(uint64_t clk)
 {
     uint64_t before = rdtsc();
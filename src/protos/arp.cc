@@ -17,54 +17,60 @@ namespace stcp {
 
 void arp_module::init()
 {
-    mp = pool_create(
+    pools.create(
             "ARP Mem Pool",
-            ST_ARPMODULE_MEMPOOL_NSEG * eth_dev_count(),
-            ST_ARPMODULE_MP_CACHESIZ,
-            ST_MBUF_BUFSIZ,
-            cpu_socket_id());
+            core::tune.arp_mempool_nseg * eth_dev_count(),
+            core::tune.arp_mp_cachesiz,
+            core::tune.mbuf_bufsiz,
+            core::dplane.numa_nodes());
+
+    table_mask = core::tune.arp_table_size - 1;
+    table = reinterpret_cast<arp_entry*>(rte::zmalloc("ARP table",
+                sizeof(arp_entry) * core::tune.arp_table_size, RTE_CACHE_LINE_SIZE));
+
+    uint64_t hz = tsc_hz();
+    reachable_cycles = hz / MS_PER_S * ST_ARP_REACHABLE_MS;
+    retrans_cycles   = hz / MS_PER_S * ST_ARP_RETRANS_MS;
+    gc_stale_cycles  = hz / MS_PER_S * ST_ARP_GC_STALE_MS;
 }
 
 
 
 void arp_module::rx_push(mbuf* msg)
 {
+    struct stcp_arphdr* ah  = mbuf_mtod<struct stcp_arphdr*>(msg);
+    uint8_t port = msg->port;
 
-struct stcp_arphdr* ah  = mbuf_mtod<struct stcp_arphdr*>(msg);
-uint8_t port = msg->port;
+    if (ah->operation == hton16(ARPOP_REPLY)) {
 
-if (ah->operation == hton16(ARPOP_REPLY)) {
-
-    /*
-     * Proc ARP-Reply Packet
-     * using ARP table.
-     */
-
-    stcp_sockaddr     sa_pa(STCP_AF_INET);
-    stcp_sockaddr     sa_ha(STCP_AF_LINK);
-    stcp_sockaddr_in *sin_pa = reinterpret_cast<stcp_sockaddr_in*>(&sa_pa);
-
-    sin_pa->sin_addr = ah->psrc;
-    for (size_t i=0; i<stcp_ether_addr::addrlen; i++)
-            sa_ha.sa_data[i] = ah->hwsrc.addr_bytes[i];
-
-        stcp_arpreq req(&sa_pa, &sa_ha, port);
-        ioctl_siocaarpent(&req);
+        /*
+         * Proc ARP-Reply Packet
+         * using ARP table.
+         */
+        confirm(port, ah->psrc, ah->hwsrc, true);
         mbuf_free(msg);
 
     } else if (ah->operation == hton16(ARPOP_REQUEST)) {
-        if (core::is_request_to_me(ah, port)) { // TODO
+        bool to_me = core::is_request_to_me(ah, port); // TODO
+
+        /*
+         * RFC 826: the sender's mapping is merged in,
+         * and added if the request is for us.
+         */
+        confirm(port, ah->psrc, ah->hwsrc, to_me);
+
+        if (to_me) {
 
             /*
              * Reply ARP-Reply Packet
              */
 
-            mbuf* msg = mbuf_alloc(mp);
-            msg->data_len = sizeof(stcp_arphdr);
-            msg->pkt_len  = sizeof(stcp_arphdr);
-            msg->port = port;
+            mbuf* rep = mbuf_alloc(pools.local());
+            rep->data_len = sizeof(stcp_arphdr);
+            rep->pkt_len  = sizeof(stcp_arphdr);
+            rep->port = port;
 
-            stcp_arphdr* rep_ah = mbuf_mtod<stcp_arphdr*>(msg);
+            stcp_arphdr* rep_ah = mbuf_mtod<stcp_arphdr*>(rep);
             rep_ah->hwtype = hton16(0x0001);
             rep_ah->ptype  = hton16(0x0800);
             rep_ah->hwlen  = static_cast<uint8_t>(stcp_ether_addr::addrlen);
@@ -75,11 +81,11 @@ if (ah->operation == hton16(ARPOP_REPLY)) {
             rep_ah->hwdst = ah->hwsrc;
             rep_ah->pdst  = ah->psrc;
 
-            msg->port = port;
-            tx_push(msg);
-        } else {
-            mbuf_free(msg);
+            tx_push(rep);
         }
+        mbuf_free(msg);
+    } else {
+        mbuf_free(msg);
     }
 }
 
@@ -135,30 +141,268 @@ void arp_module::ioctl(uint64_t request, void* arg)
     }
 }
 
+/*
+ * Slot of (port, pa) when the table has no collisions.
+ */
+uint32_t arp_module::slot(uint8_t port, const stcp_in_addr& pa) const
+{
+    uint32_t ip;
+    memcpy(&ip, pa.addr_bytes, sizeof ip);
+    return rte::jhash_2words(ip, port, 0) & table_mask;
+}
+
+
+arp_entry* arp_module::lookup(uint8_t port, const stcp_in_addr& pa)
+{
+    for (uint32_t i=slot(port, pa); ; i=(i+1)&table_mask) {
+        arp_entry* e = &table[i];
+        if (e->state == ARPS_FREE)
+            return nullptr;
+        if (e->port == port && e->pa == pa)
+            return e;
+    }
+}
+
+
+/*
+ * Returns the entry of (port, pa), a new INCOMPLETE one if
+ * absent, or nullptr when the table is 3/4 full.
+ */
+arp_entry* arp_module::insert(uint8_t port, const stcp_in_addr& pa)
+{
+    uint32_t i = slot(port, pa);
+    for (; table[i].state != ARPS_FREE; i=(i+1)&table_mask) {
+        if (table[i].port == port && table[i].pa == pa)
+            return &table[i];
+    }
+    if (nb_entries >= (table_mask+1) / 4 * 3)
+        return nullptr;
+
+    arp_entry* e = &table[i];
+    *e = arp_entry();
+    e->pa    = pa;
+    e->port  = port;
+    e->state = ARPS_INCOMPLETE;
+    nb_entries++;
+    return e;
+}
+
+
+/*
+ * Backward-shift deletion: entries after e in its probe
+ * run move up, so lookups never need tombstones.
+ * Pointers to entries are not stable across this.
+ */
+void arp_module::erase(arp_entry* e)
+{
+    uint32_t i = e - table;
+    uint32_t j = i;
+    for (;;) {
+        j = (j+1) & table_mask;
+        if (table[j].state == ARPS_FREE)
+            break;
+        uint32_t k = slot(table[j].port, table[j].pa);
+        bool stays = (i <= j) ? (i < k && k <= j) : (i < k || k <= j);
+        if (!stays) {
+            table[i] = table[j];
+            i = j;
+        }
+    }
+    table[i].state = ARPS_FREE;
+    nb_entries--;
+    core::ip.dst_invalidate();
+}
+
+
+/*
+ * Received pa is at ha. Refreshes an existing entry,
+ * creates one only if create. Permanent ones are kept.
+ */
+void arp_module::confirm(uint8_t port, const stcp_in_addr& pa,
+        const stcp_ether_addr& ha, bool create)
+{
+    arp_entry* e = create ? insert(port, pa) : lookup(port, pa);
+    if (e == nullptr || e->state == ARPS_PERMANENT)
+        return;
+
+    if (!(e->ha == ha)) {
+        e->l2_valid = false;
+        core::ip.dst_invalidate();
+    }
+    e->ha        = ha;
+    e->state     = ARPS_REACHABLE;
+    e->probes    = 0;
+    e->confirmed = rdtsc();
+    pending_flush(e);
+}
+
+
+static inline mbuf* pending_next(const mbuf* msg)
+{
+    return reinterpret_cast<mbuf*>(msg->userdata);
+}
+
+
+/*
+ * Holds msg until its next hop resolves. Only an INCOMPLETE
+ * entry, as left by a missed arp_resolv(), takes frames; the
+ * oldest one is dropped past ST_ARP_PENDING_MAX.
+ */
+void arp_module::arp_pending(uint8_t port, const stcp_sockaddr *dst, mbuf* msg)
+{
+    const stcp_sockaddr_in* dst_in = reinterpret_cast<const stcp_sockaddr_in*>(dst);
+    arp_entry* e = lookup(port, dst_in->sin_addr);
+    if (e == nullptr || e->state != ARPS_INCOMPLETE) {
+        mbuf_free(msg);
+        pending_drops++;
+        return;
+    }
+
+    if (e->nb_pending >= ST_ARP_PENDING_MAX) {
+        mbuf* old = e->pending_head;
+        e->pending_head = pending_next(old);
+        e->nb_pending--;
+        nb_pending--;
+        mbuf_free(old);
+        pending_drops++;
+    }
+
+    msg->userdata = nullptr;
+    if (e->pending_head == nullptr)
+        e->pending_head = msg;
+    else
+        e->pending_tail->userdata = msg;
+    e->pending_tail = msg;
+    e->nb_pending++;
+    nb_pending++;
+}
+
+
+/*
+ * Sends everything held on e, called once it resolved.
+ */
+void arp_module::pending_flush(arp_entry* e)
+{
+    mbuf* msg = e->pending_head;
+    e->pending_head = nullptr;
+    e->pending_tail = nullptr;
+    nb_pending -= e->nb_pending;
+    e->nb_pending = 0;
+
+    stcp_sockaddr_in dst;
+    dst.sin_addr = e->pa;
+    uint8_t port = e->port;
+    while (msg != nullptr) {
+        mbuf* next = pending_next(msg);
+        msg->userdata = nullptr;
+        core::ether.tx_push(port, msg, reinterpret_cast<stcp_sockaddr*>(&dst));
+        msg = next;
+    }
+}
+
+
+void arp_module::pending_free(arp_entry* e)
+{
+    for (mbuf* msg=e->pending_head; msg!=nullptr; ) {
+        mbuf* next = pending_next(msg);
+        mbuf_free(msg);
+        msg = next;
+    }
+    pending_drops += e->nb_pending;
+    nb_pending    -= e->nb_pending;
+    e->pending_head = nullptr;
+    e->pending_tail = nullptr;
+    e->nb_pending   = 0;
+}
+
+
+/*
+ * Ages a few slots per call so that no full table walk
+ * is needed: REACHABLE turns STALE, unanswered requests
+ * are retried with doubling intervals then dropped along
+ * with their pending frames, long unused STALE entries go.
+ */
+void arp_module::proc()
+{
+    uint64_t now = rdtsc();
+    for (size_t n=0; n<ST_ARP_GC_STEP; n++) {
+        arp_entry* e = &table[gc_pos];
+        bool erased = false;
+
+        switch (e->state) {
+            case ARPS_REACHABLE:
+                if (now - e->confirmed > reachable_cycles)
+                    e->state = ARPS_STALE;
+                break;
+            case ARPS_STALE:
+                if (now - e->confirmed > gc_stale_cycles) {
+                    erase(e);
+                    erased = true;
+                }
+                break;
+            case ARPS_PROBE:
+                if (now - e->probed > retrans_cycles) {
+                    if (e->probes >= ST_ARP_MAX_PROBES) {
+                        erase(e);
+                        erased = true;
+                    } else {
+                        e->probes++;
+                        e->probed = now;
+                        arp_request(e->port, &e->pa, &e->ha);
+                    }
+                }
+                break;
+            case ARPS_INCOMPLETE:
+                if (e->probes > 0 &&
+                        now - e->probed > retrans_cycles << (e->probes - 1)) {
+                    if (e->probes >= ST_ARP_MAX_PROBES) {
+                        pending_free(e);
+                        erase(e);
+                        erased = true;
+                    } else {
+                        e->probes++;
+                        e->probed = now;
+                        arp_request(e->port, &e->pa);
+                    }
+                }
+                break;
+            default:
+                break;
+        }
+
+        /* an erase may have shifted a live entry into this slot */
+        if (!erased)
+            gc_pos = (gc_pos + 1) & table_mask;
+    }
+}
+
+
 /*
  * IOCTL SocketIO Add ARP Entry
  *
  * Description
+ * Adds a permanent entry on req->arp_ifindex.
  * This function evaluate only these variable of stcp_arpreq.
- *  - req->arp_ha
+ *  - req->arp_pa
  *  - req->arp_ha.sa_data[0-6]
+ *  - req->arp_ifindex
  */
 void arp_module::ioctl_siocaarpent(stcp_arpreq* req)
 {
-    for (stcp_arpreq& ent : table) {
-        if (ent.arp_pa == req->arp_pa) {
-            if (ent.arp_ha == req->arp_ha) {
-                return;
-            } else {
-                for (size_t i=0; i<stcp_ether_addr::addrlen; i++)
-                    ent.arp_ha.sa_data[i] = req->arp_ha.sa_data[i];
-                return;
-            }
-        } else {
-            continue;
-        }
-    }
-    table.push_back(*req);
+    const stcp_sockaddr_in* pa =
+        reinterpret_cast<const stcp_sockaddr_in*>(&req->arp_pa);
+    arp_entry* e = insert(req->arp_ifindex, pa->sin_addr);
+    if (e == nullptr)
+        throw exception("arp table is full");
+
+    for (size_t i=0; i<stcp_ether_addr::addrlen; i++)
+        e->ha.addr_bytes[i] = req->arp_ha.sa_data[i];
+    e->l2_valid  = false;
+    e->state     = ARPS_PERMANENT;
+    core::ip.dst_invalidate();
+    e->probes    = 0;
+    e->confirmed = rdtsc();
+    pending_flush(e);
 }
 
 
@@ -167,18 +411,18 @@ void arp_module::ioctl_siocaarpent(stcp_arpreq* req)
  *
  * Description
  * This functino evaluate only these variables of stcp_arpreq.
+ *  - arp_pa
  *  - arp_ifindex
  */
 void arp_module::ioctl_siocdarpent(stcp_arpreq* req)
 {
-    for (size_t i=0; i<table.size(); i++) {
-        if (req->arp_pa == table[i].arp_pa &&
-                table[i].arp_ifindex == req->arp_ifindex) {
-            table.erase(table.begin() + i);
-            return ;
-        }
-    }
-    throw exception("arp record not found");
+    const stcp_sockaddr_in* pa =
+        reinterpret_cast<const stcp_sockaddr_in*>(&req->arp_pa);
+    arp_entry* e = lookup(req->arp_ifindex, pa->sin_addr);
+    if (e == nullptr)
+        throw exception("arp record not found");
+    pending_free(e);
+    erase(e);
 }
 
 
@@ -186,13 +430,25 @@ void arp_module::ioctl_siocdarpent(stcp_arpreq* req)
  * IOCTL SocketIO Get ARP Entrys
  *
  * Description
- *  User can get raw-arptable's pointer. and it is no-const pointer.
- *  But now, I don't assume unsafe operation to arptable's pointer.
- *  So this function's argument will be const pointer to be safety.
+ *  User gets a snapshot of the resolved entries,
+ *  valid until the next call.
  */
 void arp_module::ioctl_siocgarpent(std::vector<stcp_arpreq>** tbl)
 {
-    *tbl = &table;
+    table_snapshot.clear();
+    for (uint32_t i=0; i<=table_mask; i++) {
+        const arp_entry& e = table[i];
+        if (e.state == ARPS_FREE || e.state == ARPS_INCOMPLETE)
+            continue;
+
+        stcp_arpreq req;
+        reinterpret_cast<stcp_sockaddr_in*>(&req.arp_pa)->sin_addr = e.pa;
+        for (size_t j=0; j<stcp_ether_addr::addrlen; j++)
+            req.arp_ha.sa_data[j] = e.ha.addr_bytes[j];
+        req.arp_ifindex = e.port;
+        table_snapshot.push_back(req);
+    }
+    *tbl = &table_snapshot;
 }
 
 
@@ -207,29 +463,102 @@ void arp_module::ioctl_siocgdarp(bool* b)
 
 
 
-bool arp_module::arp_resolv(
-        uint8_t port, const stcp_sockaddr *dst, stcp_ether_addr* dsten, bool checkcacheonly)
+/*
+ * Plain ports get [pad][dst][src][type], sub-interfaces
+ * tagged in software get [dst][src][0x8100][tci] and
+ * ether_module appends the inner type.
+ */
+void arp_module::l2_build(arp_entry* e)
+{
+    const ifnet& dev = core::dplane.devices[e->port];
+    if (dev.vlan_sw_tag()) {
+        stcp_ether_header* eh = reinterpret_cast<stcp_ether_header*>(e->l2_hdr);
+        eh->dst  = e->ha;
+        core::get_mymac(&eh->src, e->port);
+        eh->type = hton16(ETHERTYPE_VLAN);
+        *reinterpret_cast<uint16_t*>(e->l2_hdr + 14) = hton16(dev.vid());
+    } else {
+        stcp_ether_header* eh = reinterpret_cast<stcp_ether_header*>(e->l2_hdr + 2);
+        e->l2_hdr[0] = 0;
+        e->l2_hdr[1] = 0;
+        eh->dst  = e->ha;
+        core::get_mymac(&eh->src, e->port);
+        eh->type = hton16(ETHERTYPE_IP);
+    }
+    e->l2_valid = true;
+}
+
+
+/*
+ * Called when port's mac changes.
+ */
+void arp_module::l2_invalidate(uint8_t port)
+{
+    if (table == nullptr)
+        return;
+    for (uint32_t i=0; i<=table_mask; i++) {
+        if (table[i].port == port)
+            table[i].l2_valid = false;
+    }
+    core::ip.dst_invalidate();
+}
+
+
+/*
+ * Lets a socket keep e's header while e is known good:
+ * until reachability runs out, forever if permanent.
+ * Other states leave l2c invalid so that every send
+ * goes through arp_resolv() and drives the probes.
+ */
+void arp_module::l2_cache_fill(const arp_entry* e, ether_l2_cache* l2c) const
+{
+    rte::mov16(l2c->hdr, e->l2_hdr);
+    if (e->state == ARPS_PERMANENT)
+        l2c->expire = UINT64_MAX;
+    else if (e->state == ARPS_REACHABLE)
+        l2c->expire = e->confirmed + reachable_cycles;
+    else
+        l2c->expire = 0;
+}
+
+
+/*
+ * Returns the entry with a valid l2_hdr, or nullptr on a
+ * miss; the caller then hands its frame to arp_pending().
+ * Only the first miss of a neighbor sends a request,
+ * proc() retransmits it while replies are missing.
+ */
+const arp_entry* arp_module::arp_resolv(uint8_t port, const stcp_sockaddr *dst)
 {
     const stcp_sockaddr_in* dst_in = reinterpret_cast<const stcp_sockaddr_in*>(dst);
-    for (stcp_arpreq& req : table) {
-        stcp_sockaddr_in* req_in = reinterpret_cast<stcp_sockaddr_in*>(&req.arp_pa);
-        if (req_in->sin_addr==dst_in->sin_addr && req.arp_ifindex==port) {
-            for (size_t i=0; i<stcp_ether_addr::addrlen; i++)
-                dsten->addr_bytes[i] = req.arp_ha.sa_data[i];
-            return true;
+    uint64_t now = rdtsc();
+
+    arp_entry* e = lookup(port, dst_in->sin_addr);
+    if (e != nullptr && e->state != ARPS_INCOMPLETE) {
+        if (e->state == ARPS_REACHABLE && now - e->confirmed > reachable_cycles)
+            e->state = ARPS_STALE;
+        if (e->state == ARPS_STALE) {
+            e->state  = ARPS_PROBE;
+            e->probes = 1;
+            e->probed = now;
+            arp_request(port, &e->pa, &e->ha);
         }
-    }
-    if (checkcacheonly) {
-        for (size_t i=0; i<stcp_ether_addr::addrlen; i++)
-            dsten->addr_bytes[i] = 0x00;
-        return false;
+        if (!e->l2_valid)
+            l2_build(e);
+        return e;
     }
 
     if (use_dynamic_arp) {
-        arp_request(port, &dst_in->sin_addr);
-        for (size_t i=0; i<stcp_ether_addr::addrlen; i++)
-            dsten->addr_bytes[i] = 0x00;
-        return false;
+        if (e == nullptr)
+            e = insert(port, dst_in->sin_addr);
+        if (e == nullptr || e->probes == 0) {
+            if (e != nullptr) {
+                e->probes = 1;
+                e->probed = now;
+            }
+            arp_request(port, &dst_in->sin_addr);
+        }
+        return nullptr;
     } else {
         throw exception("no such record in arp-table");
     }
@@ -238,9 +567,14 @@ bool arp_module::arp_resolv(
 
 
 
-void arp_module::arp_request(uint8_t port, const stcp_in_addr* tip)
+/*
+ * Broadcast request, or unicast to tha when
+ * reconfirming a known neighbor.
+ */
+void arp_module::arp_request(uint8_t port, const stcp_in_addr* tip,
+        const stcp_ether_addr* tha)
 {
-    mbuf* msg = mbuf_alloc(mp);
+    mbuf* msg = mbuf_alloc(pools.local());
     msg->data_len = sizeof(stcp_arphdr);
     msg->pkt_len  = sizeof(stcp_arphdr);
     msg->port = port;
@@ -253,13 +587,30 @@ void arp_module::arp_request(uint8_t port, const stcp_in_addr* tip)
     req_ah->operation = hton16(ARPOP_REQUEST);
     core::get_mymac(&req_ah->hwsrc, port); // TODO
     core::get_myip(&req_ah->psrc, port); // TODO
-    for (size_t i=0; i<stcp_ether_addr::addrlen; i++) {
-        req_ah->hwdst.addr_bytes[i] = 0x00;
+    if (tha != nullptr) {
+        req_ah->hwdst = *tha;
+    } else {
+        for (size_t i=0; i<stcp_ether_addr::addrlen; i++) {
+            req_ah->hwdst.addr_bytes[i] = 0x00;
+        }
     }
     req_ah->pdst = *tip;
     tx_push(msg);
 }
 
+
+static const char* arpstate2str(uint8_t state)
+{
+    switch (state) {
+        case ARPS_INCOMPLETE: return "INCOMPLETE";
+        case ARPS_REACHABLE : return "REACHABLE";
+        case ARPS_STALE     : return "STALE";
+        case ARPS_PROBE     : return "PROBE";
+        case ARPS_PERMANENT : return "PERMANENT";
+        default             : return "FREE";
+    }
+}
+
 void arp_module::print_stat() const
 {
     size_t rootx = core::screen.POS_ARP.x;
@@ -267,21 +618,30 @@ void arp_module::print_stat() const
     core::screen.move(rooty, rootx);
 
     core::screen.printwln("ARP module");
-    core::screen.printwln(" Pool: %u/%u", pool_use_count(mp), pool_size(mp));
-    core::screen.printwln(" Waiting packs  : %zd", arpresolv_wait_queue.size());
+    core::screen.printwln(" Pool: %u/%u", pools.use_count(), pools.size());
+    core::screen.printwln(" Waiting packs  : %zd (drops %zd)", nb_pending, pending_drops);
     core::screen.printwln(" Use dynamic arp: %s", use_dynamic_arp ? "YES" : "NO");
-    core::screen.printwln(" ARP-chace");
-    core::screen.printwln(" %-16s %-20s %s", "Address", "HWaddress", "Iface");
-
-    size_t i=0;
-    for (const stcp_arpreq& a : table) {
-        std::string pa = a.arp_pa.c_str();
-        std::string ha = a.arp_ha.c_str();
-        core::screen.printwln(" %-16s %-20s %d",
-                pa.c_str(),
-                ha.c_str(),
-                a.arp_ifindex);
-        i++; // TODO ERASE
+    core::screen.printwln(" ARP-chace %zd/%u", nb_entries, table_mask+1);
+    core::screen.printwln(" %-16s %-20s %-5s %s", "Address", "HWaddress", "Iface", "State");
+
+    const size_t max_lines = 16;
+    size_t n = 0;
+    for (uint32_t i=0; i<=table_mask && n<max_lines; i++) {
+        const arp_entry& e = table[i];
+        if (e.state == ARPS_FREE)
+            continue;
+
+        char pa[16];
+        char ha[18];
+        snprintf(pa, sizeof pa, "%u.%u.%u.%u",
+                e.pa.addr_bytes[0], e.pa.addr_bytes[1],
+                e.pa.addr_bytes[2], e.pa.addr_bytes[3]);
+        snprintf(ha, sizeof ha, "%02x:%02x:%02x:%02x:%02x:%02x",
+                e.ha.addr_bytes[0], e.ha.addr_bytes[1], e.ha.addr_bytes[2],
+                e.ha.addr_bytes[3], e.ha.addr_bytes[4], e.ha.addr_bytes[5]);
+        core::screen.printwln(" %-16s %-20s %-5d %s",
+                pa, ha, e.port, arpstate2str(e.state));
+        n++;
     }
 }
 
@@ -10,23 +10,12 @@ namespace stcp {
 
 
 
-void ether_module::proc()
-{
-    if (!core::arp.arpresolv_wait_queue.empty()) {
-        wait_ent e = core::arp.arpresolv_wait_queue.front();
-
-        stcp_ether_addr ether_dst;
-        bool ret = core::arp.arp_resolv(e.msg->port, &e.dst, &ether_dst, true);
-
-        if (ret) {
-            tx_push(e.port, e.msg, &e.dst);
-            core::arp.arpresolv_wait_queue.pop();
-        }
-    }
-}
-
-
-void ether_module::tx_push(uint8_t port, mbuf* msg, const stcp_sockaddr* dst)
+/*
+ * l2c, if given, short-cuts the neighbor lookup for IPv4
+ * while it is fresh and is refilled from arp otherwise.
+ */
+void ether_module::tx_push(uint8_t port, mbuf* msg, const stcp_sockaddr* dst,
+        ether_l2_cache* l2c)
 {
     stcp_ether_addr ether_src;
     stcp_ether_addr ether_dst;
@@ -35,16 +24,47 @@ void ether_module::tx_push(uint8_t port, mbuf* msg, const stcp_sockaddr* dst)
     switch (dst->sa_fam) {
         case STCP_AF_INET:
         {
-            ether_type = ntoh16(ETHERTYPE_IP);
+            const uint8_t* l2_hdr;
+            if (l2c != nullptr && rdtsc() < l2c->expire) {
+                l2_hdr = l2c->hdr;
+            } else {
+                const arp_entry* ne = core::arp.arp_resolv(port, dst);
+                if (ne == nullptr) {
+                    core::arp.arp_pending(port, dst, msg);
+                    return;
+                }
+                if (l2c != nullptr)
+                    core::arp.l2_cache_fill(ne, l2c);
+                l2_hdr = ne->l2_hdr;
+            }
 
-            bool  ret = core::arp.arp_resolv(port, dst, &ether_dst);
-            if (!ret) {
-                wait_ent e(port, msg, *dst);
-                core::arp.arpresolv_wait_queue.push(e);
+            ifnet& dev = core::dplane.devices[port];
+            if (unlikely(dev.vlan_sw_tag())) {
+                /*
+                 * Template holds dst, src and the 802.1Q tag,
+                 * the inner type follows it.
+                 */
+                uint8_t* eh = reinterpret_cast<uint8_t*>(mbuf_push(msg,
+                        sizeof(stcp_ether_header) + sizeof(stcp_vlan_header)));
+                rte::mov16(eh, l2_hdr);
+                *reinterpret_cast<uint16_t*>(eh + 16) = hton16(ETHERTYPE_IP);
+                dev.tx_push(core::dplane.queue_id(), msg);
                 return;
             }
 
-            break;
+            /*
+             * Neighbor's prebuilt header in one 16-byte move,
+             * its 2 leading pad bytes land in the headroom.
+             */
+            uint8_t* eh = reinterpret_cast<uint8_t*>(
+                    mbuf_push(msg, sizeof(stcp_ether_header)));
+            if (likely(rte::pktmbuf_headroom(msg) >= 2))
+                rte::mov16(eh - 2, l2_hdr);
+            else
+                memcpy(eh, l2_hdr + 2, sizeof(stcp_ether_header));
+
+            dev.tx_push(core::dplane.queue_id(), msg);
+            return;
         }
         case STCP_AF_ARP:
         {
@@ -82,11 +102,20 @@ void ether_module::tx_push(uint8_t port, mbuf* msg, const stcp_sockaddr* dst)
     }
 
 
+    ifnet& dev = core::dplane.devices[port];
+    if (dev.vlan_sw_tag()) {
+        stcp_vlan_header* vh =
+            reinterpret_cast<stcp_vlan_header*>(mbuf_push(msg, sizeof(stcp_vlan_header)));
+        vh->tci  = hton16(dev.vid());
+        vh->type = ether_type;
+        ether_type = hton16(ETHERTYPE_VLAN);
+    }
+
     stcp_ether_header* eh =
         reinterpret_cast<stcp_ether_header*>(mbuf_push(msg, sizeof(stcp_ether_header)));
 
     memset(&ether_src, 0, sizeof(ether_src));
-    for (ifaddr& ifa : core::dplane.devices[port].addrs) {
+    for (ifaddr& ifa : dev.addrs) {
         if (ifa.family == STCP_AF_LINK) {
             for (size_t i=0; i<stcp_ether_addr::addrlen; i++)
                 ether_src.addr_bytes[i] = ifa.raw.sa_data[i];
@@ -99,35 +128,81 @@ void ether_module::tx_push(uint8_t port, mbuf* msg, const stcp_sockaddr* dst)
     }
     eh->type = ether_type;
 
-    for (ifnet& dev : core::dplane.devices) {
-        dev.tx_push(msg);
-    }
+    dev.tx_push(core::dplane.queue_id(), msg);
 }
 
 
-void ether_module::rx_push(mbuf* msg)
+/*
+ * Classify a burst by ethertype and hand the IPv4
+ * sub-vector to ip_module in one call.
+ * nb_msgs must not exceed BURST_SIZE.
+ */
+void ether_module::rx_burst(mbuf** msgs, uint16_t nb_msgs)
 {
-    stcp_ether_header* eh = mbuf_mtod<stcp_ether_header*>(msg);
-    uint16_t etype = ntoh16(eh->type);
-    mbuf_pull(msg, sizeof(stcp_ether_header));
+    mbuf* ip_msgs[BURST_SIZE];
+    uint16_t nb_ip = 0;
 
-    switch (etype) {
-        case ETHERTYPE_IP:
-        {
-            core::ip.rx_push(msg);
-            break;
+    for (uint16_t i=0; i<PREFETCH_OFFSET && i<nb_msgs; i++) {
+        prefetch0(mbuf_mtod<void*>(msgs[i]));
+    }
+
+    for (uint16_t i=0; i<nb_msgs; i++) {
+        if (i + PREFETCH_OFFSET < nb_msgs) {
+            prefetch0(mbuf_mtod<void*>(msgs[i + PREFETCH_OFFSET]));
         }
-        case ETHERTYPE_ARP:
-        {
-            core::arp.rx_push(msg);
-            break;
+
+        mbuf* msg = msgs[i];
+        stcp_ether_header* eh = mbuf_mtod<stcp_ether_header*>(msg);
+        uint16_t etype = ntoh16(eh->type);
+        mbuf_pull(msg, sizeof(stcp_ether_header));
+
+        /*
+         * Tagged frames go to their sub-interface: the tag is
+         * either stripped by the NIC into vlan_tci or still
+         * inline, in which case it is pulled with the header.
+         */
+        uint16_t vid = 0;
+        if (etype == ETHERTYPE_VLAN) {
+            stcp_vlan_header* vh = mbuf_mtod<stcp_vlan_header*>(msg);
+            vid   = ntoh16(vh->tci) & 0x0fff;
+            etype = ntoh16(vh->type);
+            mbuf_pull(msg, sizeof(stcp_vlan_header));
+        } else if ((msg->ol_flags & PKT_RX_VLAN_PKT) &&
+                (core::dplane.devices[msg->port].rx_offload & DEV_RX_OFFLOAD_VLAN_STRIP)) {
+            vid = msg->vlan_tci & 0x0fff;
         }
-        default:
-        {
-            mbuf_free(msg);
-            break;
+        if (vid != 0) {
+            uint8_t ifindex = core::dplane.vlan_ifindex(msg->port, vid);
+            if (ifindex == 0) {
+                rx_vlan_unknown++;
+                mbuf_free(msg);
+                continue;
+            }
+            msg->port = ifindex;
+        }
+
+        switch (etype) {
+            case ETHERTYPE_IP:
+            {
+                ip_msgs[nb_ip++] = msg;
+                break;
+            }
+            case ETHERTYPE_ARP:
+            {
+                core::arp.rx_push(msg);
+                break;
+            }
+            default:
+            {
+                mbuf_free(msg);
+                break;
+            }
         }
     }
+
+    if (nb_ip > 0) {
+        core::ip.rx_burst(ip_msgs, nb_ip);
+    }
 }
 
 
@@ -50,7 +50,11 @@ void icmp_module::send_err(icmp_type type, icmp_code code, const stcp_sockaddr_i
 
 
 
-void icmp_module::rx_push(mbuf* msg, const stcp_sockaddr_in* src)
+/*
+ * dst is the address the message was sent to,
+ * echo replies come from it.
+ */
+void icmp_module::rx_push(mbuf* msg, const stcp_sockaddr_in* src, const stcp_in_addr* dst)
 {
 
     stcp_icmp_header* ih = mbuf_mtod<stcp_icmp_header*>(msg);
@@ -70,7 +74,9 @@ void icmp_module::rx_push(mbuf* msg, const stcp_sockaddr_in* src)
                 free(buf);
             }
 
-            core::ip.tx_push(msg, src, STCP_IPPROTO_ICMP);
+            ip_dst_cache dc;
+            dc.laddr = *dst;
+            core::ip.tx_push(msg, src, STCP_IPPROTO_ICMP, &dc);
             break;
         }
         case STCP_ICMP_ECHOREPLY:
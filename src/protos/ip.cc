@@ -2,6 +2,7 @@
 
 
 
+#include <algorithm>
 #include <stcp/protos/ip.h>
 #include <stcp/protos/icmp.h>
 #include <stcp/protos/ethernet.h>
@@ -21,40 +22,146 @@ namespace stcp {
 void ip_module::init()
 {
 
-    direct_pool = pool_create(
+    direct_pools.create(
             "IP Direct Pool",
-            ST_IPMODULE_DIR_MEMPOOL_NSEG * eth_dev_count(),
-            ST_IPMODULE_DIR_MP_CACHESIZ,
-            ST_MBUF_BUFSIZ,
-            cpu_socket_id());
+            core::tune.ip_dir_mempool_nseg * eth_dev_count(),
+            core::tune.ip_dir_mp_cachesiz,
+            core::tune.mbuf_bufsiz,
+            core::dplane.numa_nodes());
 
 
-    indirect_pool = pool_create(
+    indirect_pools.create(
             "IP Indirect Pool",
-            ST_IPMODULE_IND_MEMPOOL_NSEG * eth_dev_count(),
-            ST_IPMODULE_IND_MP_CACHESIZ,
+            core::tune.ip_ind_mempool_nseg * eth_dev_count(),
+            core::tune.ip_ind_mp_cachesiz,
             0, /* pool for indirect-buffer doesnt need buffersize */
-            cpu_socket_id());
-
-    uint64_t max_cycles     = (tsc_hz() + MS_PER_S - 1) / MS_PER_S * MS_PER_S;
+            core::dplane.numa_nodes());
+
+    /*
+     * Held fragments come out of the rx pools, never let
+     * reassembly take more than half of them.
+     */
+    uint32_t rx_nseg = core::tune.dataplane_mempool_nseg
+                     * eth_dev_count() * core::dplane.nb_queues();
+    if (core::tune.ipfrag_max_frags > rx_nseg / 2)
+        core::tune.ipfrag_max_frags = rx_nseg / 2;
+
+    frag_timeout_cycles = (tsc_hz() + MS_PER_S - 1) / MS_PER_S * core::tune.ipfrag_timeout_ms;
     frag_tbl = ip_frag_table_create(
-            ST_IPFRAG_NB_BUCKETS,         /* number of bucket to store fragmented packets */
-            ST_IPFRAG_NB_ENT_PER_BUCKET,  /* number of entrys to store a fragmented packet*/
-            ST_IPFRAG_MAX_ENT_PER_BUCKET, /* max entry of bucket number                   */
-            max_cycles, /* max cycle to store packets in each-buckets, timeout to drop */
+            core::tune.ipfrag_nb_buckets,         /* number of bucket to store fragmented packets */
+            core::tune.ipfrag_nb_ent_per_bucket,  /* number of entrys to store a fragmented packet*/
+            core::tune.ipfrag_max_ent_per_bucket, /* max entry of bucket number                   */
+            frag_timeout_cycles, /* max cycle to store packets in each-buckets, timeout to drop */
             cpu_socket_id());
 
+    fib = rte::lpm_create("IP FIB", cpu_socket_id(),
+            core::tune.ip_fib_max_rules, core::tune.ip_fib_nb_tbl8);
+    fib_rebuild();
+
     srand(time(NULL));
+    rte::srand(time(NULL));
+    for (ip_id_counter& c : ip_ids)
+        c.next = rte::rand();
+}
+
+
+/*
+ * An interface address or netmask changed.
+ */
+void ip_module::ifaddr_changed()
+{
+    local_rebuild();
+    fib_rebuild();
+    dst_invalidate();
+}
+
+
+static inline uint32_t local_slot(const stcp_in_addr& addr, uint32_t mask)
+{
+    uint32_t a;
+    memcpy(&a, addr.addr_bytes, sizeof a);
+    return rte::jhash_2words(a, 0, 0) & mask;
+}
+
+
+/*
+ * Sized to stay at most half full, so a miss ends
+ * after a probe or two even with many VIPs.
+ */
+void ip_module::local_rebuild()
+{
+    std::vector<stcp_in_addr> addrs;
+    std::vector<uint8_t>      ports;
+    const std::vector<ifnet>& devs = core::dplane.devices;
+
+    port_src.assign(devs.size(), stcp_in_addr::zero);
+    any_src = stcp_in_addr::zero;
+    for (size_t port=0; port<devs.size(); port++) {
+        for (const ifaddr& ifa : devs[port].addrs) {
+            if (ifa.family != STCP_AF_INET)
+                continue;
+            const stcp_sockaddr_in* sin = reinterpret_cast<const stcp_sockaddr_in*>(&ifa.raw);
+            if (port_src[port] == stcp_in_addr::zero)
+                port_src[port] = sin->sin_addr;
+            if (any_src == stcp_in_addr::zero)
+                any_src = sin->sin_addr;
+            addrs.push_back(sin->sin_addr);
+            ports.push_back(port);
+        }
+    }
+
+    uint32_t size = 16;
+    while (size < addrs.size() * 2)
+        size <<= 1;
+    ip_local_ent empty;
+    empty.used = false;
+    local_tbl.assign(size, empty);
+    local_mask = size - 1;
+
+    for (size_t i=0; i<addrs.size(); i++) {
+        uint32_t s = local_slot(addrs[i], local_mask);
+        while (local_tbl[s].used && local_tbl[s].addr != addrs[i])
+            s = (s + 1) & local_mask;
+        local_tbl[s].addr = addrs[i];
+        local_tbl[s].port = ports[i];
+        local_tbl[s].used = true;
+    }
+}
+
+
+bool ip_module::is_local(const stcp_in_addr& addr) const
+{
+    if (local_tbl.empty())
+        return false;
+    for (uint32_t s = local_slot(addr, local_mask);; s = (s + 1) & local_mask) {
+        if (!local_tbl[s].used)
+            return false;
+        if (local_tbl[s].addr == addr)
+            return true;
+    }
 }
 
 
-void ip_module::set_ipaddr(const stcp_in_addr* addr)
+/*
+ * The owner's bound address if it is still ours,
+ * else the egress port's primary, else any address.
+ */
+stcp_in_addr ip_module::src_select(const ip_dst_cache* dc) const
 {
-    myip = *addr;
+    if (dc->laddr != stcp_in_addr::zero && is_local(dc->laddr))
+        return dc->laddr;
+    if (dc->port < port_src.size() && port_src[dc->port] != stcp_in_addr::zero)
+        return port_src[dc->port];
+    return any_src;
 }
 
 
-void ip_module::rx_push(mbuf* msg)
+/*
+ * Filters and reassembles one packet.
+ * Returns the packet pointing ip-header,
+ * or nullptr if it was consumed here.
+ */
+mbuf* ip_module::rx_input(mbuf* msg)
 {
     stcp_ip_header* ih
         = mbuf_mtod<stcp_ip_header*>(msg);
@@ -62,58 +169,264 @@ void ip_module::rx_push(mbuf* msg)
     size_t trailer_len = mbuf_data_len(msg) - ntoh16(ih->total_length);
     mbuf_trim(msg, trailer_len);
 
-    if (myip != ih->dst && stcp_in_addr::broadcast != ih->dst) {
+    if (!is_local(ih->dst) && stcp_in_addr::broadcast != ih->dst) {
         not_to_me++;
         mbuf_free(msg);
-        return;
+        return nullptr;
+    }
+
+    if (!rx_ip_cksum_ok(msg, ih)) {
+        cksum_err++;
+        mbuf_free(msg);
+        return nullptr;
     }
 
     if (ipv4_frag_pkt_is_fragmented(ih)) {
-        mbuf_push(msg, sizeof(stcp_ether_header));
+        msg = rx_reassemble(msg, ih);
+    }
+    return msg;
+}
 
-        msg->l2_len = sizeof(stcp_ether_header);
-        msg->l3_len = sizeof(stcp_ip_header);
-        mbuf* reasmd_msg = ipv4_frag_reassemble_packet(
-                frag_tbl, &dr, msg, rdtsc(), ih);
 
-        if (reasmd_msg == NULL) {
-            return;
-        }
-        msg = reasmd_msg;
+static inline uint32_t frag_src_slot(const stcp_in_addr& src)
+{
+    uint32_t a;
+    memcpy(&a, src.addr_bytes, sizeof a);
+    return rte::jhash_2words(a, 0, 0) & (ST_IPFRAG_SRC_SLOTS - 1);
+}
 
-        mbuf_pull(msg, sizeof(stcp_ether_header));
-        ih = mbuf_mtod<stcp_ip_header*>(msg);
+
+/*
+ * Hands a fragment to frag_tbl within the global and
+ * per-source limits. Returns the whole datagram once
+ * its last fragment is in, nullptr until then.
+ */
+mbuf* ip_module::rx_reassemble(mbuf* msg, stcp_ip_header* ih)
+{
+    uint32_t slot = frag_src_slot(ih->src);
+    if (frag_held >= core::tune.ipfrag_max_frags ||
+            frag_src_held[slot] >= core::tune.ipfrag_max_frags_per_src) {
+        frag_limited++;
+        mbuf_free(msg);
+        return nullptr;
     }
 
-    mbuf_pull(msg, sizeof(stcp_ip_header));
+    const stcp_in_addr src = ih->src;
+    uint64_t now = rdtsc();
+    mbuf_push(msg, sizeof(stcp_ether_header));
+    msg->l2_len  = sizeof(stcp_ether_header);
+    msg->l3_len  = sizeof(stcp_ip_header);
+    msg->udata64 = now;
+    frag_held++;
+    frag_src_held[slot]++;
 
-    stcp_sockaddr_in src;
-    src.sin_addr = ih->src;
-    uint8_t protocol = ih->next_proto_id;
-    switch (protocol) {
-        case STCP_IPPROTO_ICMP:
-        {
-            core::icmp.rx_push(msg, &src);
-            break;
+    mbuf* reasmd_msg = ipv4_frag_reassemble_packet(frag_tbl, &dr, msg, now, ih);
+
+    /* a single call may evict a full entry, keep room for it */
+    if (dr.cnt >= IP_FRAG_DEATH_ROW_LEN)
+        frag_free_death_row();
+
+    if (reasmd_msg == nullptr)
+        return nullptr;
+
+    frag_done++;
+    frag_release(src, reasmd_msg->nb_segs);
+    mbuf_pull(reasmd_msg, sizeof(stcp_ether_header));
+    return reasmd_msg;
+}
+
+
+void ip_module::frag_release(const stcp_in_addr& src, uint32_t n)
+{
+    uint32_t slot = frag_src_slot(src);
+    frag_held           -= std::min(n, frag_held);
+    frag_src_held[slot] -= std::min<uint32_t>(n, frag_src_held[slot]);
+}
+
+
+/*
+ * Frees what frag_tbl dropped: fragments of timed-out
+ * datagrams, of evicted ones and malformed fragments.
+ * They still point at the ethernet header we pushed.
+ */
+void ip_module::frag_free_death_row()
+{
+    uint64_t now = rdtsc();
+    for (uint32_t i=0; i<dr.cnt; i++) {
+        mbuf* m = dr.row[i];
+        const stcp_ip_header* ih = reinterpret_cast<const stcp_ip_header*>(
+                mbuf_mtod<uint8_t*>(m) + m->l2_len);
+        if (now - m->udata64 >= frag_timeout_cycles)
+            frag_timedout++;
+        else
+            frag_evicted++;
+        frag_release(ih->src, 1);
+    }
+    rte::ip_frag_free_death_row(&dr, PREFETCH_OFFSET);
+}
+
+
+/*
+ * frag_tbl drops a stale datagram only when another fragment
+ * of it arrives, and the held limits refuse new fragments
+ * before they get to frag_tbl. Without this, datagrams that
+ * never complete would keep the limits full for good.
+ * The lru list is in start order, only its head is checked.
+ */
+void ip_module::frag_expire()
+{
+    uint64_t now = rdtsc();
+    while (rte::ip_frag_tbl_expire_oldest(frag_tbl, &dr, now)) {
+        if (dr.cnt >= IP_FRAG_DEATH_ROW_LEN)
+            frag_free_death_row();
+    }
+}
+
+
+void ip_module::proc()
+{
+    frag_expire();
+    if (dr.cnt > 0) frag_free_death_row();
+}
+
+
+/*
+ * Trust the NIC if it verified the header,
+ * otherwise check it here.
+ */
+bool ip_module::rx_ip_cksum_ok(const mbuf* msg, const stcp_ip_header* ih) const
+{
+    if (core::dplane.devices[msg->port].rx_offload & DEV_RX_OFFLOAD_IPV4_CKSUM) {
+        return (msg->ol_flags & PKT_RX_IP_CKSUM_BAD) == 0;
+    }
+    return ipv4_cksum(ih) == 0xffff;
+}
+
+
+/*
+ * TCP/UDP checksum over a chained mbuf, l4 starts l4_off
+ * bytes into msg. Segments beginning on an odd l4 offset
+ * have their partial sum byte-swapped before folding.
+ */
+static uint16_t ipv4_udptcp_cksum_chain(const stcp_ip_header* ih,
+        const mbuf* msg, size_t l4_off)
+{
+    size_t   remain = ntoh16(ih->total_length) - sizeof(stcp_ip_header);
+    size_t   done   = 0;
+    uint32_t sum    = ipv4_phdr_cksum(ih, 0);
+
+    for (const mbuf* seg=msg; seg!=nullptr && remain>0; seg=seg->next) {
+        if (l4_off >= seg->data_len) {
+            l4_off -= seg->data_len;
+            continue;
         }
-        case STCP_IPPROTO_TCP:
-        {
-            core::tcp.rx_push(msg, &src);
-            break;
+        size_t len = std::min<size_t>(seg->data_len - l4_off, remain);
+        uint32_t s = rte::raw_cksum(
+                rte_pktmbuf_mtod_offset(seg, const uint8_t*, l4_off), len);
+        if (done & 1) {
+            s = ((s & 0xff) << 8) | (s >> 8);
         }
-        case STCP_IPPROTO_UDP:
-        {
-            core::udp.rx_push(msg, &src);
-            break;
+        sum    += s;
+        done   += len;
+        remain -= len;
+        l4_off  = 0;
+    }
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    uint16_t cksum = ~sum;
+    return cksum == 0 ? 0xffff : cksum;
+}
+
+
+/*
+ * ih points the ip-header in front of msg's L4 header.
+ * Chained (reassembled) datagrams are summed segment by
+ * segment in software.
+ */
+bool ip_module::rx_l4_cksum_ok(const mbuf* msg, const stcp_ip_header* ih) const
+{
+    uint32_t capa = ih->next_proto_id == STCP_IPPROTO_TCP ?
+        DEV_RX_OFFLOAD_TCP_CKSUM : DEV_RX_OFFLOAD_UDP_CKSUM;
+    if (core::dplane.devices[msg->port].rx_offload & capa) {
+        return (msg->ol_flags & PKT_RX_L4_CKSUM_BAD) == 0;
+    }
+    const void* l4 = reinterpret_cast<const uint8_t*>(ih) + sizeof(stcp_ip_header);
+    if (ih->next_proto_id == STCP_IPPROTO_UDP &&
+            reinterpret_cast<const stcp_udp_header*>(l4)->cksum == 0) {
+        return true; /* sender did not compute it */
+    }
+    if (!mbuf_is_contiguous(msg)) {
+        return ipv4_udptcp_cksum_chain(ih, msg, 0) == 0xffff;
+    }
+    return ipv4_udptcp_cksum(ih, l4) == 0xffff;
+}
+
+
+/*
+ * Classify a burst by L4 protocol and hand the TCP and UDP
+ * sub-vectors to their modules in one call each.
+ * nb_msgs must not exceed BURST_SIZE.
+ */
+void ip_module::rx_burst(mbuf** msgs, uint16_t nb_msgs)
+{
+    mbuf*            tcp_msgs[BURST_SIZE];
+    stcp_sockaddr_in tcp_srcs[BURST_SIZE];
+    uint16_t         nb_tcp = 0;
+    mbuf*            udp_msgs[BURST_SIZE];
+    stcp_sockaddr_in udp_srcs[BURST_SIZE];
+    uint16_t         nb_udp = 0;
+
+    for (uint16_t i=0; i<nb_msgs; i++) {
+        mbuf* msg = rx_input(msgs[i]);
+        if (msg == nullptr) continue;
+
+        stcp_ip_header* ih = mbuf_mtod<stcp_ip_header*>(msg);
+        mbuf_pull(msg, sizeof(stcp_ip_header));
+
+        uint8_t protocol = ih->next_proto_id;
+        if ((protocol == STCP_IPPROTO_TCP || protocol == STCP_IPPROTO_UDP)
+                && !rx_l4_cksum_ok(msg, ih)) {
+            cksum_err++;
+            mbuf_free(msg);
+            continue;
         }
-        default:
-        {
-            mbuf_push(msg, sizeof(stcp_ip_header));
-            core::icmp.send_err(STCP_ICMP_UNREACH,
-                    STCP_ICMP_UNREACH_PROTOCOL, &src, msg);
-            break;
+
+        switch (protocol) {
+            case STCP_IPPROTO_ICMP:
+            {
+                stcp_sockaddr_in src;
+                src.sin_addr = ih->src;
+                core::icmp.rx_push(msg, &src, &ih->dst);
+                break;
+            }
+            case STCP_IPPROTO_TCP:
+            {
+                tcp_srcs[nb_tcp].sin_addr = ih->src;
+                tcp_msgs[nb_tcp++] = msg;
+                break;
+            }
+            case STCP_IPPROTO_UDP:
+            {
+                udp_srcs[nb_udp].sin_addr = ih->src;
+                udp_msgs[nb_udp++] = msg;
+                break;
+            }
+            default:
+            {
+                stcp_sockaddr_in src;
+                src.sin_addr = ih->src;
+                mbuf_push(msg, sizeof(stcp_ip_header));
+                core::icmp.send_err(STCP_ICMP_UNREACH,
+                        STCP_ICMP_UNREACH_PROTOCOL, &src, msg);
+                break;
+            }
         }
     }
+
+    if (dr.cnt > 0) frag_free_death_row();
+
+    if (nb_tcp > 0) core::tcp.rx_burst(tcp_msgs, tcp_srcs, nb_tcp);
+    if (nb_udp > 0) core::udp.rx_burst(udp_msgs, udp_srcs, nb_udp);
 }
 
 
@@ -164,6 +477,9 @@ void ip_module::ioctl(uint64_t request, void* args)
 void ip_module::ioctl_siocaddrt(const stcp_rtentry* rt)
 {
     rttable.push_back(*rt);
+    if (fib != nullptr)
+        fib_insert(*rt);
+    dst_invalidate();
 }
 
 
@@ -178,14 +494,22 @@ void ip_module::ioctl_siocaddgw(stcp_rtentry* rt)
     rt->rt_genmask.inet_addr(0, 0, 0, 0);
     rt->rt_flags = STCP_RTF_GATEWAY;
     rttable.push_back(*rt);
+    if (fib != nullptr)
+        fib_insert(*rt);
+    dst_invalidate();
 }
 
 
+/*
+ * A deleted prefix may uncover an older route or a
+ * connected one with the same prefix, so rebuild.
+ */
 void ip_module::ioctl_siocdelrt(const stcp_rtentry* rt)
 {
     for (size_t i=0; i<rttable.size(); i++) {
         if (*rt == rttable[i]) {
             rttable.erase(rttable.begin() + i);
+            fib_rebuild();
             return;
         }
     }
@@ -197,73 +521,248 @@ void ip_module::ioctl_siocgetrts(std::vector<stcp_rtentry>** table)
     *table = &rttable;
 }
 
-void ip_module::route_resolv(const stcp_sockaddr_in* dst, stcp_sockaddr_in* next, uint8_t* port)
+
+static inline uint32_t in_addr_u32(const stcp_in_addr& a)
 {
-    dataplane& dpdk = core::dplane;
+    return  (uint32_t(a.addr_bytes[0]) << 24) | (uint32_t(a.addr_bytes[1]) << 16)
+          | (uint32_t(a.addr_bytes[2]) <<  8) |  uint32_t(a.addr_bytes[3]);
+}
 
-    for (size_t i=0; i<dpdk.devices.size(); i++) {
-        if (is_linklocal(i, dst)) {
-            *next = *dst;
-            *port = i;
-            return;
-        }
+static inline uint8_t mask_depth(const stcp_in_addr& mask)
+{
+    return __builtin_popcount(in_addr_u32(mask));
+}
+
+
+/*
+ * Next hops are few (one per gateway and port),
+ * a scan is enough to share them between prefixes.
+ */
+uint32_t ip_module::nexthop_id(const stcp_in_addr& gw, uint8_t port)
+{
+    for (size_t i=0; i<nexthops.size(); i++) {
+        if (nexthops[i].gateway == gw && nexthops[i].port == port)
+            return i;
     }
+    ip_nexthop nh;
+    nh.gateway = gw;
+    nh.port    = port;
+    nexthops.push_back(nh);
+    return nexthops.size() - 1;
+}
 
-    for (stcp_rtentry& rt : rttable) {
-        if (rt.rt_flags & STCP_RTF_GATEWAY) {
-            *next = rt.rt_gateway;
-            *port = rt.rt_port;
-            return;
-        }
+
+/*
+ * Same prefix and depth replaces the previous next hop.
+ */
+void ip_module::fib_insert(const stcp_in_addr& dst, uint8_t depth,
+        const stcp_in_addr& gw, uint8_t port)
+{
+    uint32_t nh = nexthop_id(gw, port);
+    if (depth == 0) {
+        default_nh = nh;
+        return;
+    }
+    uint32_t prefix = in_addr_u32(dst) & (~0u << (32 - depth));
+    rte::lpm_add(fib, prefix, depth, nh);
+}
+
+void ip_module::fib_insert(const stcp_rtentry& rt)
+{
+    const stcp_in_addr& gw = (rt.rt_flags & STCP_RTF_GATEWAY) ?
+        rt.rt_gateway.sin_addr : stcp_in_addr::zero;
+    fib_insert(rt.rt_route.sin_addr, mask_depth(rt.rt_genmask.sin_addr), gw, rt.rt_port);
+}
+
+
+/*
+ * Reloads the LPM from the interface addresses and rttable,
+ * called when an address or netmask changes.
+ * Static routes go in after the connected ones and win
+ * on an equal prefix.
+ */
+void ip_module::fib_rebuild()
+{
+    if (fib == nullptr)
+        return;
+
+    rte::lpm_delete_all(fib);
+    nexthops.clear();
+    default_nh = no_nexthop;
+    dst_invalidate();
+
+    for (size_t port=0; port<core::dplane.devices.size(); port++) {
+        stcp_in_addr addr;
+        stcp_in_addr mask;
+        if (!if_inaddr(port, &addr, &mask))
+            continue;
+        uint8_t depth = mask_depth(mask);
+        if (depth > 0)
+            fib_insert(addr, depth, stcp_in_addr::zero, port);
     }
+    for (const stcp_rtentry& rt : rttable)
+        fib_insert(rt);
+}
+
 
-    throw exception("not found route");
+void ip_module::route_resolv(const stcp_sockaddr_in* dst, stcp_sockaddr_in* next, uint8_t* port)
+{
+    uint32_t nh;
+    if (rte::lpm_lookup(fib, in_addr_u32(dst->sin_addr), &nh) != 0) {
+        if (default_nh == no_nexthop)
+            throw exception("not found route");
+        nh = default_nh;
+    }
+
+    const ip_nexthop& hop = nexthops[nh];
+    *next = *dst;
+    if (hop.gateway != stcp_in_addr::zero)
+        next->sin_addr = hop.gateway;
+    *port = hop.port;
 }
 
-bool ip_module::is_linklocal(uint8_t port, const stcp_sockaddr_in* addr)
+/*
+ * Refills dc for dst unless it is still current,
+ * the steady state of a connection costs one compare.
+ */
+void ip_module::dst_resolv(ip_dst_cache* dc, const stcp_sockaddr_in* dst)
+{
+    if (likely(dc->gen == dst_gen && dc->dst == dst->sin_addr))
+        return;
+
+    route_resolv(dst, &dc->next, &dc->port);
+    dc->next.sin_fam  = STCP_AF_INET;
+    dc->dst           = dst->sin_addr;
+    dc->src           = src_select(dc);
+    dc->mtu           = ip_module::mtu;
+    dc->tx_offload    = core::dplane.devices[dc->port].tx_offload;
+    dc->l2.expire     = 0;
+    dc->gen           = dst_gen;
+}
+
+/*
+ * Senders check this before queueing more data,
+ * true while the egress port's tx backlog is nearly full.
+ */
+bool ip_module::tx_throttled(const stcp_sockaddr_in* dst, ip_dst_cache* dc)
+{
+    ip_dst_cache tmp;
+    if (dc == nullptr) dc = &tmp;
+    dst_resolv(dc, dst);
+    const ifnet& dev = core::dplane.devices[dc->port];
+    return core::dplane.devices[dev.parent()].tx_full(core::dplane.queue_id());
+}
+
+/*
+ * DEV_TX_OFFLOAD_* usable towards dst.
+ */
+uint32_t ip_module::tx_offload_capa(const stcp_sockaddr_in* dst, ip_dst_cache* dc)
+{
+    ip_dst_cache tmp;
+    if (dc == nullptr) dc = &tmp;
+    dst_resolv(dc, dst);
+    return dc->tx_offload;
+}
+
+/*
+ * Primary address and netmask of port,
+ * false if either is unset.
+ */
+bool ip_module::if_inaddr(uint8_t port, stcp_in_addr* addr, stcp_in_addr* mask) const
 {
-    dataplane& dpdk = core::dplane;
-    stcp_sockaddr inaddr(STCP_AF_INET);
-    stcp_sockaddr inmask(STCP_AF_INET);
-    stcp_sockaddr innet(STCP_AF_INET);
     bool inaddr_exist = false;
     bool inmask_exist = false;
 
-    for (ifaddr& ifa : dpdk.devices[port].addrs) {
-        if (ifa.family == STCP_AF_INET) {
-            inaddr = ifa.raw;
+    for (const ifaddr& ifa : core::dplane.devices[port].addrs) {
+        const stcp_sockaddr_in* sin = reinterpret_cast<const stcp_sockaddr_in*>(&ifa.raw);
+        if (ifa.family == STCP_AF_INET && !inaddr_exist) {
+            *addr = sin->sin_addr;  /* primary */
             inaddr_exist = true;
         }
         if (ifa.family == STCP_AF_INMASK) {
-            inmask = ifa.raw;
+            *mask = sin->sin_addr;
             inmask_exist = true;
         }
     }
+    return inaddr_exist && inmask_exist;
+}
+
+
+/*
+ * Fills IPv4 header checksum, by the NIC if the port can.
+ */
+void ip_module::tx_ip_cksum(mbuf* msg, uint32_t tx_offload)
+{
+    stcp_ip_header* ih = mbuf_mtod<stcp_ip_header*>(msg);
+    ih->hdr_checksum = 0x0000;
 
-    if (!inaddr_exist || !inmask_exist) {
-        throw exception("inaddr or inmask is not exist");
+    if (tx_offload & DEV_TX_OFFLOAD_IPV4_CKSUM) {
+        msg->ol_flags |= PKT_TX_IPV4 | PKT_TX_IP_CKSUM;
+        msg->l2_len = sizeof(stcp_ether_header);
+        msg->l3_len = sizeof(stcp_ip_header);
+    } else {
+        ih->hdr_checksum = ipv4_cksum(ih);
     }
+}
 
-    stcp_sockaddr_in* inaddr_sin = reinterpret_cast<stcp_sockaddr_in*>(&inaddr);
-    stcp_sockaddr_in* inmask_sin = reinterpret_cast<stcp_sockaddr_in*>(&inmask);
-    stcp_sockaddr_in* innet_sin  = reinterpret_cast<stcp_sockaddr_in*>(&innet );
 
-    for (size_t i=0; i<stcp_in_addr::addrlen; i++) {
-        innet_sin->sin_addr.addr_bytes[i] =   inaddr_sin->sin_addr.addr_bytes[i]
-                                            & inmask_sin->sin_addr.addr_bytes[i];
+/*
+ * Fills TCP/UDP checksum. With offload only the pseudo-header
+ * sum is seeded here and the NIC completes it.
+ */
+void ip_module::tx_l4_cksum(mbuf* msg, stcp_ip_header* ih,
+        ip_l4_protos proto, uint32_t tx_offload)
+{
+    uint8_t*  l4 = reinterpret_cast<uint8_t*>(ih) + sizeof(stcp_ip_header);
+    uint16_t* cksum;
+    uint64_t  flag;
+    uint32_t  capa;
+
+    switch (proto) {
+        case STCP_IPPROTO_TCP:
+            cksum = &reinterpret_cast<stcp_tcp_header*>(l4)->cksum;
+            flag  = PKT_TX_TCP_CKSUM;
+            capa  = DEV_TX_OFFLOAD_TCP_CKSUM;
+            break;
+        case STCP_IPPROTO_UDP:
+            cksum = &reinterpret_cast<stcp_udp_header*>(l4)->cksum;
+            flag  = PKT_TX_UDP_CKSUM;
+            capa  = DEV_TX_OFFLOAD_UDP_CKSUM;
+            break;
+        default:
+            return;
     }
 
-    for (size_t i=0; i<stcp_in_addr::addrlen; i++) {
-        if ((inmask_sin->sin_addr.addr_bytes[i] & addr->sin_addr.addr_bytes[i])
-                != innet_sin->sin_addr.addr_bytes[i])
-            return false;
+    *cksum = 0x0000;
+    if (tx_offload & capa) {
+        msg->ol_flags |= PKT_TX_IPV4 | flag;
+        msg->l2_len = sizeof(stcp_ether_header);
+        msg->l3_len = sizeof(stcp_ip_header);
+        *cksum = ipv4_phdr_cksum(ih, msg->ol_flags);
+    } else if (!mbuf_is_contiguous(msg)) {
+        *cksum = ipv4_udptcp_cksum_chain(ih, msg, sizeof(stcp_ip_header));
+    } else {
+        *cksum = ipv4_udptcp_cksum(ih, l4);
     }
-    return true;
 }
 
 
-void ip_module::tx_push(mbuf* msg, const stcp_sockaddr_in* dst, ip_l4_protos proto)
+/*
+ * dc is the sender's cache for dst, if it keeps one;
+ * without it route and neighbor are looked up every time.
+ */
+void ip_module::tx_push(mbuf* msg, const stcp_sockaddr_in* dst, ip_l4_protos proto,
+        ip_dst_cache* dc)
 {
+    ip_dst_cache tmp;
+    if (dc == nullptr) dc = &tmp;
+    dst_resolv(dc, dst);
+    uint8_t  port       = dc->port;
+    uint32_t tx_offload = dc->tx_offload;
+    stcp_sockaddr* next = reinterpret_cast<stcp_sockaddr*>(&dc->next);
+    bool tso = proto == STCP_IPPROTO_TCP
+            && (msg->ol_flags & PKT_TX_TCP_SEG)
+            && (tx_offload & DEV_TX_OFFLOAD_TCP_TSO);
 
     stcp_ip_header* ih
         = reinterpret_cast<stcp_ip_header*>(mbuf_push(msg, sizeof(stcp_ip_header)));
@@ -271,9 +770,10 @@ void ip_module::tx_push(mbuf* msg, const stcp_sockaddr_in* dst, ip_l4_protos pro
     ih->version_ihl       = 0x45;
     ih->type_of_service   = 0x00;
     ih->total_length      = hton16(mbuf_pkt_len(msg));
-    ih->packet_id         = hton16(rand() % 0xffff);
+    ih->packet_id         = next_ip_id();
 
-    if (mbuf_pkt_len(msg) > ip_module::mtu) {
+    bool need_fragment = !tso && mbuf_pkt_len(msg) > dc->mtu;
+    if (need_fragment) {
         ih->fragment_offset = hton16(0x0000);
     } else {
         ih->fragment_offset   = hton16(0x4000);
@@ -281,42 +781,70 @@ void ip_module::tx_push(mbuf* msg, const stcp_sockaddr_in* dst, ip_l4_protos pro
 
     ih->time_to_live      = ip_module::ttl_default;
     ih->next_proto_id     = proto;
-    ih->src               = myip;
+    ih->src               = dc->src;
     ih->dst               = dst->sin_addr;
     ih->hdr_checksum      = 0x00;
 
-    ih->hdr_checksum = ipv4_cksum(ih);
+    /*
+     * TCP hands us segments above mss only if the port does
+     * TSO; the NIC cuts them to tso_segsz and fills ip id and
+     * both checksums of every segment.
+     */
+    if (tso) {
+        stcp_tcp_header* th = reinterpret_cast<stcp_tcp_header*>(ih + 1);
+        msg->ol_flags = PKT_TX_IPV4 | PKT_TX_IP_CKSUM | PKT_TX_TCP_SEG;
+        msg->l2_len   = sizeof(stcp_ether_header);
+        msg->l3_len   = sizeof(stcp_ip_header);
+        msg->l4_len   = (th->data_off >> 4) << 2;
+        th->cksum     = ipv4_phdr_cksum(ih, msg->ol_flags);
 
-    mbuf* msgs[ip_module::num_max_fragment];
-    memset(msgs, 0, sizeof msgs);
-    uint32_t nb = ipv4_fragment_packet(msg, &msgs[0], 10,
-            ip_module::mtu,
-            direct_pool, indirect_pool);
+        msg->port = port;
+        core::ether.tx_push(msg->port, msg, next, &dc->l2);
+        return;
+    }
 
-    stcp_sockaddr_in next;
-    uint8_t port;
-    route_resolv(dst, &next, &port);
-    next.sin_fam = STCP_AF_INET;
+    msg->ol_flags = 0;
 
-    if (nb > 1) { /* packet was fragmented */
-        mbuf_free(msg);
+    /*
+     * Fits the MTU: straight to ether_module,
+     * the fragmenter and its pools are not touched.
+     */
+    if (likely(!need_fragment)) {
+        tx_l4_cksum(msg, ih, proto, tx_offload);
+        tx_ip_cksum(msg, tx_offload);
+        tx_direct++;
 
-        if (ip_module::num_max_fragment < nb) {
-            throw exception("Too Fragment maybe overflow");
-        }
-        for (size_t i=0; i<nb; i++) {
+        msg->port = port;
+        core::ether.tx_push(msg->port, msg, next, &dc->l2);
+        return;
+    }
 
-            stcp_ip_header* iph = mbuf_mtod<stcp_ip_header*>(msgs[i]);
-            iph->hdr_checksum = ipv4_cksum(iph);
+    /*
+     * The NIC would sum each fragment on its own,
+     * so the L4 checksum of a datagram to be fragmented
+     * is always computed in software.
+     */
+    tx_l4_cksum(msg, ih, proto, 0);
 
-            msgs[i]->port = port;
-            core::ether.tx_push(msgs[i]->port, msgs[i],
-                    reinterpret_cast<stcp_sockaddr*>(&next));
-        }
-    } else { /* packet was not fragmented */
-        msg->port = port;
-        core::ether.tx_push(msg->port, msg,
-                reinterpret_cast<stcp_sockaddr*>(&next));
+    mbuf* msgs[ip_module::num_max_fragment];
+    uint32_t nb = ipv4_fragment_packet(msg, &msgs[0], ip_module::num_max_fragment,
+            dc->mtu,
+            direct_pool(), indirect_pool());
+    mbuf_free(msg);
+
+    /* it reports failure as 1, which cannot be right here */
+    if (unlikely(nb <= 1)) {
+        tx_frag_err++;
+        return;
+    }
+
+    tx_frags += nb;
+    for (size_t i=0; i<nb; i++) {
+        msgs[i]->ol_flags = 0;
+        tx_ip_cksum(msgs[i], tx_offload);
+
+        msgs[i]->port = port;
+        core::ether.tx_push(msgs[i]->port, msgs[i], next, &dc->l2);
     }
 }
 
@@ -329,14 +857,33 @@ void ip_module::print_stat() const
 
     core::screen.printwln("IP module");
     core::screen.printwln(" DirectPool  : %u/%u",
-            pool_use_count(direct_pool), pool_size(direct_pool));
+            direct_pools.use_count(), direct_pools.size());
     core::screen.printwln(" IndirectPool: %u/%u",
-            pool_use_count(indirect_pool), pool_size(indirect_pool));
+            indirect_pools.use_count(), indirect_pools.size());
     core::screen.printwln(" Drops      %zd", not_to_me);
+    core::screen.printwln(" Cksum err  %zd", cksum_err);
+    core::screen.printwln(" Tx direct/fragments/frag-err %zd/%zd/%zd",
+            tx_direct, tx_frags, tx_frag_err);
+    core::screen.printwln(" Reasm in-progress/held %u/%u done %zd",
+            frag_tbl ? frag_tbl->use_entries : 0, frag_held, frag_done);
+    core::screen.printwln(" Reasm timedout/evicted/limited %zd/%zd/%zd",
+            frag_timedout, frag_evicted, frag_limited);
     core::screen.printwln(" Routing-Table");
     core::screen.printwln(
             " %-16s%-16s%-16s%-6s%-3s", "Destination", "Gateway", "Genmask", "Flags", "if");
 
+    for (size_t port=0; port<core::dplane.devices.size(); port++) {
+        stcp_in_addr addr;
+        stcp_in_addr mask;
+        if (!if_inaddr(port, &addr, &mask))
+            continue;
+        for (size_t i=0; i<stcp_in_addr::addrlen; i++)
+            addr.addr_bytes[i] &= mask.addr_bytes[i];
+        std::string str_dest = addr.c_str();
+        core::screen.printwln(" %-16s%-16s%-16s%-6s%-3zu",
+                str_dest.c_str(), "*", mask.c_str(), "L", port);
+    }
+
     for (const stcp_rtentry& rt : rttable) {
         std::string str_dest;
         if (rt.rt_flags & STCP_RTF_GATEWAY) {
@@ -7,6 +7,7 @@
 #include <stcp/arch/dpdk/device.h>
 #include <stcp/protos/tcp_util.h>
 #include <stcp/tuning.h>
+#include <new>
 #define UNUSED(x) (void)(x)
 
 namespace stcp {
@@ -17,33 +18,275 @@ size_t tcp_module::mss = 1460;
 
 void tcp_module::init()
 {
-    mp = pool_create(
+    max_socks = core::tune.tcp_nb_socket_alloc;
+    /* slab_grow() must not throw */
+    free_socks.reserve(max_socks);
+    slabs.reserve(max_socks / core::tune.tcp_sock_slab + 1);
+    pools.create(
             "TCP Mem Pool",
-            ST_TCPMODULE_MEMPOOL_NSEG * eth_dev_count(),
-            ST_TCPMODULE_MP_CACHESIZ,
-            ST_MBUF_BUFSIZ,
-            cpu_socket_id());
+            core::tune.tcp_mempool_nseg * eth_dev_count(),
+            core::tune.tcp_mp_cachesiz,
+            core::tune.mbuf_bufsiz,
+            core::dplane.numa_nodes());
+
+    /*
+     * Each socket is in the table at most once. Sized twice
+     * the sockets so that a bucket rarely overflows.
+     */
+    conns = rte::hash_create("TCP Conn Table",
+            std::max<uint32_t>(core::tune.tcp_nb_socket_alloc * 2, 64),
+            sizeof(tcp_conn_key), rte::socket_id());
+}
+
+
+/*
+ * Constructs one more slab of sockets on hugepages and puts
+ * them on the free list. Returns false when hugepages are out.
+ * A socket allocates nothing when constructed, its queues are
+ * linked through the mbufs.
+ */
+bool tcp_module::slab_grow()
+{
+    size_t n = std::min<size_t>(core::tune.tcp_sock_slab, max_socks - nb_socks);
+    void* mem = rte::malloc("TCP Sock Slab",
+            n * sizeof(stcp_tcp_sock), RTE_CACHE_LINE_SIZE);
+    if (mem == nullptr)
+        return false;
+
+    stcp_tcp_sock* slab = reinterpret_cast<stcp_tcp_sock*>(mem);
+    for (size_t i=0; i<n; i++) {
+        new (&slab[i]) stcp_tcp_sock;
+    }
+    slabs.push_back(slab);
+    nb_socks += n;
+
+    /* lower address is handed out first */
+    for (size_t i=n; i>0; i--) {
+        free_socks.push_back(&slab[i-1]);
+    }
+    return true;
+}
+
+
+stcp_tcp_sock* tcp_module::sock_alloc()
+{
+    stcp_tcp_sock* s = sock_try_alloc();
+    if (s == nullptr) {
+        throw exception("NO SOCKET SPACE");
+    }
+    return s;
+}
+
+
+/*
+ * Returns nullptr when the pool is at max_socks or cannot
+ * grow, for the rx path which must not throw.
+ */
+stcp_tcp_sock* tcp_module::sock_try_alloc()
+{
+    if (free_socks.empty()) {
+        if (nb_socks >= max_socks || !slab_grow()) {
+            return nullptr;
+        }
+    }
+
+    stcp_tcp_sock* s = free_socks.back();
+    free_socks.pop_back();
+    s->init();
+    s->sock_state = SOCKS_USE;
+
+    s->used_prev = nullptr;
+    s->used_next = used_head;
+    if (used_head != nullptr)
+        used_head->used_prev = s;
+    used_head = s;
+    nb_used++;
+    return s;
+}
+
+
+/*
+ * Freeing an unused socket does nothing. Sockets the app
+ * holds come here only from destroy_tcp_socket(), the stack
+ * leaves them SOCKS_DEAD when they close.
+ */
+void tcp_module::sock_free(stcp_tcp_sock* sock)
+{
+    if (sock->sock_state == SOCKS_UNUSE)
+        return;
+
+    sock->term();
+    sock->sock_state = SOCKS_UNUSE;
+
+    if (sock->used_prev != nullptr)
+        sock->used_prev->used_next = sock->used_next;
+    else
+        used_head = sock->used_next;
+    if (sock->used_next != nullptr)
+        sock->used_next->used_prev = sock->used_prev;
+    sock->used_prev = nullptr;
+    sock->used_next = nullptr;
+    nb_used--;
+
+    free_socks.push_back(sock);
+}
+
+
+static inline void conn_key_set(tcp_conn_key* key,
+        const stcp_in_addr& laddr, uint16_t lport,
+        const stcp_in_addr& raddr, uint16_t rport)
+{
+    memset(key, 0, sizeof(tcp_conn_key));
+    key->laddr = laddr;
+    key->raddr = raddr;
+    key->lport = lport;
+    key->rport = rport;
+}
+
+
+/*
+ * An exact 4-tuple match wins, else the socket listening on
+ * the port. Listeners are keyed on the port only, bind()
+ * does not keep a local address.
+ */
+stcp_tcp_sock* tcp_module::sock_lookup(const stcp_in_addr& laddr, uint16_t lport,
+        const stcp_in_addr& raddr, uint16_t rport)
+{
+    tcp_conn_key key;
+    conn_key_set(&key, laddr, lport, raddr, rport);
+
+    void* data;
+    if (rte::hash_lookup_data(conns, &key, &data) >= 0) {
+        return reinterpret_cast<stcp_tcp_sock*>(data);
+    }
+    return listeners[ntoh16(lport)];
+}
+
+
+/*
+ * Returns false when the table has no room for sock.
+ */
+bool tcp_module::conn_insert(stcp_tcp_sock* sock)
+{
+    tcp_conn_key key;
+    conn_key_set(&key, sock->addr.sin_addr, sock->port,
+            sock->pair.sin_addr, sock->pair_port);
+    if (rte::hash_add_key_data(conns, &key, sock) < 0) {
+        return false;
+    }
+    sock->hashed = true;
+    nb_conns++;
+    return true;
+}
+
+
+void tcp_module::conn_erase(stcp_tcp_sock* sock)
+{
+    tcp_conn_key key;
+    conn_key_set(&key, sock->addr.sin_addr, sock->port,
+            sock->pair.sin_addr, sock->pair_port);
+    if (rte::hash_del_key(conns, &key) >= 0) {
+        nb_conns--;
+    }
+    sock->hashed = false;
+}
+
+
+void tcp_module::listen_insert(stcp_tcp_sock* sock)
+{
+    stcp_tcp_sock*& ent = listeners[ntoh16(sock->port)];
+    if (ent != nullptr && ent != sock) {
+        throw exception("tcp: port already listening");
+    }
+    ent = sock;
+    sock->hashed = true;
+}
+
+
+void tcp_module::listen_erase(stcp_tcp_sock* sock)
+{
+    stcp_tcp_sock*& ent = listeners[ntoh16(sock->port)];
+    if (ent == sock) {
+        ent = nullptr;
+    }
+    sock->hashed = false;
 }
 
 
 /*
  * msg's head must points ip-header
+ * TCP checksum is filled by ip_module::tx_push(),
+ * in hardware if the egress port can.
  */
-void tcp_module::tx_push(mbuf* msg, const stcp_sockaddr_in* dst)
+void tcp_module::tx_push(mbuf* msg, const stcp_sockaddr_in* dst, ip_dst_cache* dc)
 {
     mbuf_pull(msg, sizeof(stcp_ip_header));
-    core::ip.tx_push(msg, dst, STCP_IPPROTO_TCP);
+    core::ip.tx_push(msg, dst, STCP_IPPROTO_TCP, dc);
 }
 
 
-void tcp_module::proc()
+void tcp_module::timer_insert(stcp_tcp_sock* sock)
+{
+    sock->timer_prev = nullptr;
+    sock->timer_next = timer_head;
+    if (timer_head != nullptr)
+        timer_head->timer_prev = sock;
+    timer_head = sock;
+}
+
+
+void tcp_module::timer_erase(stcp_tcp_sock* sock)
 {
-    for (size_t i=0; i<socks.size(); i++) {
-        socks[i].proc();
+    if (sock->timer_prev != nullptr)
+        sock->timer_prev->timer_next = sock->timer_next;
+    else
+        timer_head = sock->timer_next;
+    if (sock->timer_next != nullptr)
+        sock->timer_next->timer_prev = sock->timer_prev;
+    sock->timer_prev = nullptr;
+    sock->timer_next = nullptr;
+}
+
+
+/*
+ * Fires expired retransmission timers, at 1ms resolution.
+ * Only sockets with unacknowledged data are on the list.
+ */
+void tcp_module::timer_proc()
+{
+    uint64_t now = rdtsc();
+    if (now < timer_next_check)
+        return;
+    timer_next_check = now + tsc_hz() / 1000;
+
+    stcp_tcp_sock* next;
+    for (stcp_tcp_sock* s=timer_head; s!=nullptr; s=next) {
+        next = s->timer_next;
+        if (s->rto_expire <= now)
+            s->rtx_timeout();
     }
 }
 
 
+/*
+ * Only sockets on tx_work are visited. One still having
+ * txq left (throttled) is queued again for the next call.
+ */
+void tcp_module::proc()
+{
+    timer_proc();
+
+    tx_work.drain([](stcp_tcp_sock* s) {
+        s->tx_pending = false;
+        if (s->sock_state == SOCKS_UNUSE)
+            return;
+        s->proc();
+        if (!s->txq.empty())
+            s->tx_kick();
+    });
+}
+
+
 
 
 void tcp_module::print_stat() const
@@ -53,68 +296,171 @@ void tcp_module::print_stat() const
     core::screen.move(rooty, rootx);
 
     core::screen.printwln("TCP module");
-    core::screen.printwln(" Pool: %u/%u", pool_use_count(mp), pool_size(mp));
+    core::screen.printwln(" Pool: %u/%u", pools.use_count(), pools.size());
+    core::screen.printwln(" Connections: %zd, Rx no socket: %zd, SYN dropped: %zd",
+            nb_conns, rx_nosock, rx_syn_drop);
+    core::screen.printwln(" Rx out of order dropped: %zd", rx_ooo);
+    core::screen.printwln(" GRO merged segments: %zd", gro_merged);
+    core::screen.printwln(" TSO sends/GSO segments: %zd/%zd", tso_sent, gso_segs);
+    core::screen.printwln(" Retransmits timeout/fast: %zd/%zd, aborts: %zd",
+            rtx_timeouts, rtx_fast, rtx_aborts);
 
-    if (!socks.empty()) {
-        core::screen.printwln(" NetStat %zd ports", socks.size());
+    core::screen.printwln(" Sockets: %zd/%zd used, %zd constructed, %zd tx pending",
+            nb_used, max_socks, nb_socks, tx_work.size());
+
+    if (used_head != nullptr) {
+        core::screen.printwln(" NetStat %zd ports", nb_used);
     }
 
-    for (size_t i=0; i<socks.size(); i++) {
-        socks[i].print_stat(rootx, 8*i + rooty+3);
+    /* first ones only, the screen is not that tall */
+    size_t i = 0;
+    for (const stcp_tcp_sock* s=used_head; s!=nullptr && i<8; s=s->used_next, i++) {
+        s->print_stat(rootx, 8*i + rooty+8);
     }
 }
 
 
 
-void tcp_module::rx_push(mbuf* msg, stcp_sockaddr_in* src)
+/*
+ * Software GRO, flushed at the end of every rx burst.
+ *
+ * In-order data segments carrying only ACK(/PSH) of the same
+ * flow, with equal ack number and options, are appended to the
+ * first one as an mbuf chain and its ip total_length is grown.
+ * Other segments pass through and close the flow for merging,
+ * so arrival order is kept. msgs/srcs are compacted in place,
+ * returns how many are left. nb_msgs must not exceed BURST_SIZE.
+ */
+uint16_t tcp_module::rx_gro(mbuf** msgs, stcp_sockaddr_in* srcs, uint16_t nb_msgs)
 {
-    stcp_tcp_header* th = mbuf_mtod<stcp_tcp_header*>(msg);
+    struct gro_flow {
+        uint16_t idx;      /* head segment, index to compacted msgs */
+        uint32_t next_seq; /* HostByteOrder                         */
+        bool     open;     /* head can still take segments          */
+    } flows[BURST_SIZE];
+    size_t   nb_flows = 0;
+    uint16_t nb_out   = 0;
 
-    bool find_socket = false;
-    uint16_t dst_port = th->dport;
-    for (stcp_tcp_sock& sock : socks) {
-        if (sock.port == dst_port) {
-            if (sock.rxq.size() > 1000) { // TODO super hardcode
-                for (int i=0; i<100; i++) // TODO super hardcode
-                    mbuf_free(sock.rxq.pop());
+    for (uint16_t i=0; i<nb_msgs; i++) {
+        mbuf* msg = msgs[i];
+        mbuf_push(msg, sizeof(stcp_ip_header));
+        tcpip* tih = mtod_tih(msg);
+
+        uint16_t dlen   = data_len(tih);
+        uint32_t seq    = ntoh32(tih->tcp.seq);
+        bool candidate  = dlen > 0 && HAVE(tih, TCPF_ACK)
+                       && (tih->tcp.flags & ~(TCPF_ACK|TCPF_PSH)) == 0;
+
+        gro_flow* f = nullptr;
+        for (size_t j=0; j<nb_flows; j++) {
+            tcpip* h = mtod_tih(msgs[flows[j].idx]);
+            if (h->tcp.sport == tih->tcp.sport && h->tcp.dport == tih->tcp.dport
+                    && h->ip.dst == tih->ip.dst
+                    && srcs[flows[j].idx].sin_addr == srcs[i].sin_addr) {
+                f = &flows[j];
+                break;
+            }
+        }
+
+        if (f != nullptr && f->open && candidate && f->next_seq == seq) {
+            mbuf*  head = msgs[f->idx];
+            tcpip* h    = mtod_tih(head);
+            uint16_t hlen    = sizeof(stcp_ip_header) + ((tih->tcp.data_off>>4)<<2);
+            uint32_t merged  = ntoh16(h->ip.total_length) + dlen;
+
+            if (h->tcp.ack == tih->tcp.ack
+                    && h->tcp.data_off == tih->tcp.data_off
+                    && memcmp(&h->tcp + 1, &tih->tcp + 1, opt_len(tih)) == 0
+                    && merged <= 0xffff
+                    && head->nb_segs + msg->nb_segs < 0xff) {
+                h->ip.total_length = hton16(merged);
+                h->tcp.flags      |= tih->tcp.flags & TCPF_PSH;
+                h->tcp.rx_win      = tih->tcp.rx_win;
+                mbuf_pull(msg, hlen);
+                mbuf_chain(head, msg);
+
+                f->next_seq += dlen;
+                gro_merged++;
+                continue;
             }
-            mbuf* m = mbuf_clone(msg, core::tcp.mp);
-            mbuf_push(m, sizeof(stcp_ip_header));
-            sock.rx_push(m, src);
-            find_socket = true;
         }
+
+        msgs[nb_out] = msg;
+        srcs[nb_out] = srcs[i];
+        if (f == nullptr) {
+            f = &flows[nb_flows++];
+        }
+        f->idx      = nb_out;
+        f->next_seq = seq + dlen;
+        f->open     = candidate;
+        nb_out++;
+    }
+
+    for (uint16_t i=0; i<nb_out; i++) {
+        mbuf_pull(msgs[i], sizeof(stcp_ip_header));
     }
+    return nb_out;
+}
 
-    if (!find_socket) {
+
+void tcp_module::rx_burst(mbuf** msgs, stcp_sockaddr_in* srcs, uint16_t nb_msgs)
+{
+    nb_msgs = rx_gro(msgs, srcs, nb_msgs);
+    for (uint16_t i=0; i<nb_msgs; i++) {
+        rx_push(msgs[i], &srcs[i]);
+    }
+}
+
+
+/*
+ * msg's head must points tcp-header, the ip-header
+ * is still in front of it.
+ */
+void tcp_module::rx_push(mbuf* msg, stcp_sockaddr_in* src)
+{
+    stcp_tcp_header* th = mbuf_mtod<stcp_tcp_header*>(msg);
+    const stcp_ip_header* ih = reinterpret_cast<const stcp_ip_header*>(
+            reinterpret_cast<uint8_t*>(th) - sizeof(stcp_ip_header));
+
+    stcp_tcp_sock* sock = sock_lookup(ih->dst, th->dport, src->sin_addr, th->sport);
+    if (sock != nullptr) {
+        if (sock->rxq.size() > 1000) { // TODO super hardcode
+            for (int i=0; i<100; i++) // TODO super hardcode
+                mbuf_free(sock->rxq.pop());
+        }
         mbuf_push(msg, sizeof(stcp_ip_header));
-        tcpip* tih = mtod_tih(msg);
+        sock->rx_push(msg, src);
+        return;
+    }
+
+    /*
+     * No socket, answer with RST
+     */
+    rx_nosock++;
+    mbuf_push(msg, sizeof(stcp_ip_header));
+    tcpip* tih = mtod_tih(msg);
+
+    /*
+     * Delete TCP Option field
+     */
+    mbuf_trim(msg, opt_len(tih));
 
-        /*
-         * Delete TCP Option field
-         */
-        mbuf_trim(msg, opt_len(tih));
-
-        /*
-         * Set TCP/IP hdr
-         */
-        tih->ip.src           = tih->ip.dst;
-        tih->ip.dst           = src->sin_addr;
-        tih->ip.next_proto_id = STCP_IPPROTO_TCP;
-        tih->ip.total_length  = hton16(mbuf_pkt_len(msg));
-        swap_port(tih);
-        tih->tcp.ack      = tih->tcp.seq + hton32(1);
-        tih->tcp.seq      = 0;
-        tih->tcp.data_off = sizeof(stcp_tcp_header)/4 << 4;
-        tih->tcp.flags    = TCPF_RST|TCPF_ACK;
-        tih->tcp.rx_win   = 0;
-        tih->tcp.cksum    = 0x0000;
-        tih->tcp.urp      = 0x0000;
-
-        tih->tcp.cksum = cksum_tih(tih);
-        core::tcp.tx_push(mbuf_clone(msg, core::tcp.mp), src);
-    }
-    mbuf_free(msg);
-    return;
+    /*
+     * Set TCP/IP hdr
+     */
+    tih->ip.src           = tih->ip.dst;
+    tih->ip.dst           = src->sin_addr;
+    tih->ip.next_proto_id = STCP_IPPROTO_TCP;
+    tih->ip.total_length  = hton16(mbuf_pkt_len(msg));
+    swap_port(tih);
+    tih->tcp.ack      = tih->tcp.seq + hton32(1);
+    tih->tcp.seq      = 0;
+    tih->tcp.data_off = sizeof(stcp_tcp_header)/4 << 4;
+    tih->tcp.flags    = TCPF_RST|TCPF_ACK;
+    tih->tcp.rx_win   = 0;
+    tih->tcp.cksum    = 0x0000;
+    tih->tcp.urp      = 0x0000;
+    core::tcp.tx_push(msg, src);
 }
 
 
@@ -16,12 +16,21 @@ namespace stcp {
 
 stcp_tcp_sock::stcp_tcp_sock() :
     parent(nullptr),
+    child_prev(nullptr),
+    child_next(nullptr),
+    used_prev(nullptr),
+    used_next(nullptr),
     wait_accept_count(0),
     sock_state(SOCKS_UNUSE),
     tcp_state(TCPS_CLOSED),
+    hashed(false),
+    tx_pending(false),
     port(0),
     pair_port(0),
-    si(0, 0)
+    si(0, 0),
+    rto_expire(0),
+    timer_prev(nullptr),
+    timer_next(nullptr)
 {
     init();
 }
@@ -34,20 +43,51 @@ void stcp_tcp_sock::init()
     wait_accept_count = 0;
     sock_state = SOCKS_UNUSE;
     tcp_state  = TCPS_CLOSED;
+    hashed = false;
     port = 0;
     pair_port = 0;
+    dst_cache = ip_dst_cache();
     si.iss_H(0);
     si.irs_H(0);
+    srtt   = 0;
+    rttvar = 0;
+    rto    = core::tune.tcp_rto_init_ms * 1000;
+    nb_timeouts = 0;
+    dupacks     = 0;
+    rtx_seq     = 0;
+    rtx_ctl     = 0;
+    rtt_start   = 0;
 }
 
 void stcp_tcp_sock::term()
 {
+    for (child_list* q : { &synq, &acceptq }) {
+        while (!q->empty()) {
+            stcp_tcp_sock* s = q->head;
+            q->erase(s);
+            s->parent = nullptr;
+            core::tcp.sock_free(s);
+        }
+    }
+    wait_accept_count = 0;
+    if (hashed) {
+        if (core::tcp.listeners[ntoh16(port)] == this)
+            core::tcp.listen_erase(this);
+        else
+            core::tcp.conn_erase(this);
+    }
     while (!rxq.empty()) {
         mbuf_free(rxq.pop());
     }
     while (!txq.empty()) {
         mbuf_free(txq.pop());
     }
+    rto_disarm();
+    while (!rtxq.empty()) {
+        mbuf_free(rtxq.pop());
+    }
+    rtx_ctl   = 0;
+    rtt_start = 0;
 }
 
 
@@ -62,6 +102,18 @@ void stcp_tcp_sock::write(mbuf* msg)
         throw exception(errstr.c_str());
     }
     txq.push(msg);
+    tx_kick();
+}
+
+
+/*
+ * Puts this on the tx work list of the stack,
+ * unless it is there already.
+ */
+void stcp_tcp_sock::tx_kick()
+{
+    if (!tx_pending.exchange(true))
+        core::tcp.tx_work.push(this);
 }
 
 
@@ -90,64 +142,318 @@ stcp_tcp_sock* stcp_tcp_sock::accept(struct stcp_sockaddr_in* addr)
     UNUSED(addr);
 
     for (;;) {
-        for (stcp_tcp_sock& s : core::tcp.socks) {
-            if ((s.parent == this) && (s.sock_state == SOCKS_WAITACCEPT)) {
-                stcp_printf("[%15p] ACCEPT return new socket [%p]\n", this, &s);
-                s.sock_state = SOCKS_USE;
-                wait_accept_count--;
-                return &s;
-            }
-        }
+        while (wait_accept_count == 0) ;
+
+        std::lock_guard<std::mutex> lg(core::stack_lock);
+        if (acceptq.empty())
+            continue; /* the child was closed meanwhile */
+
+        stcp_tcp_sock* s = acceptq.head;
+        acceptq.erase(s);
+        wait_accept_count--;
+        s->parent = nullptr;
+        s->sock_state = SOCKS_USE;
+        stcp_printf("[%15p] ACCEPT return new socket [%p]\n", this, s);
+        return s;
+    }
+}
+
+
+/*
+ * child has completed the handshake, accept() may take it.
+ */
+void stcp_tcp_sock::accept_ready(stcp_tcp_sock* child)
+{
+    synq.erase(child);
+    acceptq.push_back(child);
+    wait_accept_count++;
+}
+
+
+/*
+ * Takes child, closed before being accepted, off synq
+ * or, when established, acceptq.
+ */
+void stcp_tcp_sock::accept_drop(stcp_tcp_sock* child, bool established)
+{
+    if (established) {
+        acceptq.erase(child);
+        wait_accept_count--;
+    } else {
+        synq.erase(child);
     }
 }
 
 
+void stcp_tcp_sock::child_list::push_back(stcp_tcp_sock* s)
+{
+    s->child_prev = tail;
+    s->child_next = nullptr;
+    if (tail != nullptr)
+        tail->child_next = s;
+    else
+        head = s;
+    tail = s;
+    size++;
+}
 
+
+void stcp_tcp_sock::child_list::erase(stcp_tcp_sock* s)
+{
+    if (s->child_prev != nullptr)
+        s->child_prev->child_next = s->child_next;
+    else
+        head = s->child_next;
+    if (s->child_next != nullptr)
+        s->child_next->child_prev = s->child_prev;
+    else
+        tail = s->child_prev;
+    s->child_prev = nullptr;
+    s->child_next = nullptr;
+    size--;
+}
+
+
+
+/*
+ * Sends what the app wrote. Nothing goes after our FIN,
+ * data still queued then is dropped.
+ */
 void stcp_tcp_sock::proc()
 {
+    if (rtx_ctl & TCPF_FIN) {
+        while (!txq.empty()) {
+            mbuf_free(txq.pop());
+        }
+        return;
+    }
+
     while (!txq.empty()) {
+        if (core::ip.tx_throttled(&pair, &dst_cache)) break;
+
         mbuf* msg = txq.pop();
         size_t datalen = mbuf_pkt_len(msg);
         stcp_printf("[%15p] proc_ESTABLISHED send(txq.pop(), %zd)\n",
                 this, mbuf_pkt_len(msg));
+        if (datalen == 0) {
+            mbuf_free(msg);
+            continue;
+        }
 
-        mbuf_push(msg, sizeof(stcp_ip_header));
-        mbuf_push(msg, sizeof(stcp_tcp_header));
-        tcpip* tih = mtod_tih(msg);
+        uint32_t seq = si.snd_nxt_H();
+        if (rtx_empty())
+            rtx_seq = seq;
+        rtxq.push(msg);
+        if (rtt_start == 0) {
+            rtt_seq   = seq;
+            rtt_start = rdtsc();
+        }
 
-        /*
-         * Craft IP header for tcp checksum
-         */
-        tih->ip.total_length  = hton16(mbuf_pkt_len(msg));
-        tih->ip.next_proto_id = STCP_IPPROTO_TCP;
-        tih->ip.src           = addr.sin_addr;
-        tih->ip.dst           = pair.sin_addr;
+        tx_seg(msg, seq, 0, datalen);
+        si.snd_nxt_H(seq + datalen);
+        if (rto_expire == 0)
+            rto_arm();
+    }
+}
 
-        /*
-         * Craft TCP header
-         */
-        tih->tcp.sport    = port     ;
-        tih->tcp.dport    = pair_port;
-        tih->tcp.seq      = si.snd_nxt_N();
-        tih->tcp.ack      = si.rcv_nxt_N();
-        tih->tcp.data_off = sizeof(stcp_tcp_header) >> 2 << 4;
-        tih->tcp.flags    = TCPF_PSH|TCPF_ACK;
-        tih->tcp.rx_win   = si.snd_win_N();
-        tih->tcp.urp      = 0x0000;
-        tih->tcp.cksum    = 0x0000;
-
-        tih->tcp.cksum    = cksum_tih(tih);
 
-        /*
-         * send to ip module
-         */
-        core::tcp.tx_push(msg, &pair);
-        si.snd_nxt_H(si.snd_nxt_H() + datalen);
+/*
+ * Crafts the TCP/IP header of a segment towards dst.
+ * IP header is for tcp checksum, ip_module fills the rest.
+ */
+void stcp_tcp_sock::hdr_fill(tcpip* tih, uint32_t seq, uint8_t flags,
+        size_t dlen, const stcp_sockaddr_in* dst) const
+{
+    memset(tih, 0, sizeof(tcpip));
+
+    tih->ip.total_length  = hton16(sizeof(tcpip) + dlen);
+    tih->ip.next_proto_id = STCP_IPPROTO_TCP;
+    tih->ip.src           = addr.sin_addr;
+    tih->ip.dst           = dst->sin_addr;
+
+    tih->tcp.sport    = port     ;
+    tih->tcp.dport    = pair_port;
+    tih->tcp.seq      = hton32(seq);
+    tih->tcp.ack      = si.rcv_nxt_N();
+    tih->tcp.data_off = sizeof(stcp_tcp_header) >> 2 << 4;
+    tih->tcp.flags    = flags;
+    tih->tcp.rx_win   = si.snd_win_N();
+}
 
+
+/*
+ * Sends bytes [off, off+len) of payload starting at seq.
+ * Each segment is a fresh header mbuf chained to indirect
+ * mbufs referring to payload, which stays in rtxq.
+ * Above mss it goes to the NIC whole when it does TSO and
+ * the datagram fits in ip total_length, otherwise it is cut
+ * into mss-sized segments here (software GSO).
+ */
+void stcp_tcp_sock::tx_seg(mbuf* payload, uint32_t seq, size_t off, size_t len)
+{
+    const size_t mss = core::tcp.mss;
+    bool tso = len > mss
+            && (core::ip.tx_offload_capa(&pair, &dst_cache) & DEV_TX_OFFLOAD_TCP_TSO)
+            && sizeof(tcpip) + len <= 0xffff;
+    size_t step = tso ? len : mss;
+
+    for (size_t o=0; o<len; o+=step) {
+        size_t n = std::min(step, len - o);
+        mbuf* seg = mbuf_alloc(core::tcp.pool());
+
+        tcpip* tih = reinterpret_cast<tcpip*>(mbuf_push(seg, sizeof(tcpip)));
+        uint8_t flags = (o + n < len) ? TCPF_ACK : TCPF_PSH|TCPF_ACK;
+        hdr_fill(tih, seq + o, flags, n, &pair);
+
+        mbuf_chain(seg, mbuf_slice(payload, off + o, n, core::ip.indirect_pool()));
+        if (tso) {
+            seg->ol_flags  = PKT_TX_TCP_SEG;
+            seg->tso_segsz = mss;
+            core::tcp.tso_sent++;
+        } else if (len > mss) {
+            core::tcp.gso_segs++;
+        }
+        core::tcp.tx_push(seg, &pair, &dst_cache);
     }
 }
 
 
+/*
+ * (Re)starts the retransmission timer, RFC 6298 5.1/5.3.
+ */
+void stcp_tcp_sock::rto_arm()
+{
+    bool linked = rto_expire != 0;
+    rto_expire = rdtsc() + tsc_hz() * rto / 1000000;
+    if (!linked)
+        core::tcp.timer_insert(this);
+}
+
+
+void stcp_tcp_sock::rto_disarm()
+{
+    if (rto_expire == 0)
+        return;
+    rto_expire = 0;
+    core::tcp.timer_erase(this);
+}
+
+
+/*
+ * RFC 6298 2.2/2.3, with clock granularity of 1us.
+ */
+void stcp_tcp_sock::rtt_sample(uint64_t cycles)
+{
+    uint32_t r = std::max<uint64_t>(cycles * 1000000 / tsc_hz(), 1);
+    if (srtt == 0) {
+        srtt   = r;
+        rttvar = r / 2;
+    } else {
+        uint32_t delta = srtt > r ? srtt - r : r - srtt;
+        rttvar = (3 * rttvar + delta) / 4;
+        srtt   = (7 * srtt + r) / 8;
+    }
+    rto = srtt + std::max<uint32_t>(1, 4 * rttvar);
+    rto = std::max(rto, core::tune.tcp_rto_min_ms * 1000);
+    rto = std::min(rto, core::tune.tcp_rto_max_ms * 1000);
+}
+
+
+/*
+ * snd_una advanced to ack. Frees fully acked data and the
+ * SYN/FIN, takes an RTT sample if the timed segment is acked,
+ * and restarts or stops the timer, RFC 6298 5.2/5.3.
+ */
+void stcp_tcp_sock::rtx_acked(uint32_t ack)
+{
+    while (!rtxq.empty()) {
+        uint32_t end = rtx_seq + mbuf_pkt_len(rtxq.front());
+        if (seq_gt(end, ack))
+            break;
+        mbuf_free(rtxq.pop());
+        rtx_seq = end;
+    }
+    if (rtxq.empty() && rtx_ctl != 0 && seq_gt(ack, rtx_seq)) {
+        rtx_ctl = 0;
+        rtx_seq++;
+    }
+    if (rtt_start != 0 && seq_gt(ack, rtt_seq)) {
+        rtt_sample(rdtsc() - rtt_start);
+        rtt_start = 0;
+    }
+
+    nb_timeouts = 0;
+    dupacks     = 0;
+    if (rtx_empty())
+        rto_disarm();
+    else
+        rto_arm();
+}
+
+
+/*
+ * Fast retransmit on the third duplicate ACK (RFC 5681 3.2),
+ * without congestion window as there is none yet.
+ */
+void stcp_tcp_sock::rtx_dupack()
+{
+    if (++dupacks != 3)
+        return;
+    core::tcp.rtx_fast++;
+    rtx_head();
+    rto_arm();
+}
+
+
+/*
+ * Resends the first unacknowledged data, SYN or FIN.
+ */
+void stcp_tcp_sock::rtx_head()
+{
+    if (rtxq.empty()) {
+        tx_ctl(rtx_ctl, &pair, rtx_seq);
+    } else {
+        mbuf* msg = rtxq.front();
+        uint32_t len = mbuf_pkt_len(msg);
+        uint32_t off = si.snd_una_H() - rtx_seq;
+        if (off >= len)
+            off = 0;
+        tx_seg(msg, rtx_seq + off, off, len - off);
+    }
+    rtt_start = 0;
+}
+
+
+/*
+ * RFC 6298 5.4-5.6: resend the first unacknowledged data,
+ * back off the timer and restart it. The connection is
+ * dropped after tcp.rtx_max timeouts in a row, a half-open
+ * one after tcp.synack_max.
+ */
+void stcp_tcp_sock::rtx_timeout()
+{
+    if (rtx_empty()) {
+        rto_disarm();
+        return;
+    }
+
+    core::tcp.rtx_timeouts++;
+    uint32_t max = tcp_state == TCPS_SYN_RCVD ?
+            core::tune.tcp_synack_max : core::tune.tcp_rtx_max;
+    if (++nb_timeouts > max) {
+        stcp_printf("[%15p] retransmission timeout, connection dropped\n", this);
+        core::tcp.rtx_aborts++;
+        move_state(TCPS_CLOSED);
+        return;
+    }
+
+    rto = std::min(rto * 2, core::tune.tcp_rto_max_ms * 1000);
+    dupacks = 0;
+    rtx_head();
+    rto_arm();
+}
+
+
 
 void stcp_tcp_sock::bind(const struct stcp_sockaddr_in* addr, size_t addrlen)
 {
@@ -158,8 +464,13 @@ void stcp_tcp_sock::bind(const struct stcp_sockaddr_in* addr, size_t addrlen)
 void stcp_tcp_sock::listen(size_t backlog)
 {
     if (backlog < 1) throw exception("OKASHII1944");
+    if (tcp_state != TCPS_CLOSED) throw exception("listen on not closed socket");
     wait_accept_count = 0;
     max_connect   = backlog;
+
+    /* polling lcores look listeners up */
+    std::lock_guard<std::mutex> lg(core::stack_lock);
+    core::tcp.listen_insert(this);
     move_state(TCPS_LISTEN);
 }
 
@@ -169,6 +480,7 @@ void stcp_tcp_sock::move_state(tcpstate next_state)
     stcp_printf("[%15p] %s -> %s \n", this,
             tcpstate2str(tcp_state),
             tcpstate2str(next_state) );
+    tcpstate prev_state = tcp_state;
 
     switch (tcp_state) {
         case TCPS_CLOSED     :
@@ -209,8 +521,19 @@ void stcp_tcp_sock::move_state(tcpstate next_state)
             break;
     }
     if (next_state == TCPS_CLOSED) {
-        term();
-        sock_state = SOCKS_UNUSE;
+        if (sock_state == SOCKS_WAITACCEPT) {
+            /* the app never saw this one */
+            if (parent != nullptr)
+                parent->accept_drop(this, prev_state != TCPS_SYN_RCVD);
+            core::tcp.sock_free(this);
+        } else {
+            /*
+             * The app may still hold this, the slot is
+             * reused only after destroy_tcp_socket().
+             */
+            term();
+            sock_state = SOCKS_DEAD;
+        }
     }
 }
 
@@ -256,6 +579,7 @@ void stcp_tcp_sock::move_state_from_SYN_SENT(tcpstate next_state)
 void stcp_tcp_sock::move_state_from_SYN_RCVD(tcpstate next_state)
 {
     switch (next_state) {
+        case TCPS_CLOSED:
         case TCPS_ESTABLISHED:
         case TCPS_FIN_WAIT_1:
             tcp_state = next_state;
@@ -268,6 +592,7 @@ void stcp_tcp_sock::move_state_from_SYN_RCVD(tcpstate next_state)
 void stcp_tcp_sock::move_state_from_ESTABLISHED(tcpstate next_state)
 {
     switch (next_state) {
+        case TCPS_CLOSED:
         case TCPS_FIN_WAIT_1:
         case TCPS_CLOSE_WAIT:
             tcp_state = next_state;
@@ -280,6 +605,7 @@ void stcp_tcp_sock::move_state_from_ESTABLISHED(tcpstate next_state)
 void stcp_tcp_sock::move_state_from_FIN_WAIT_1(tcpstate next_state)
 {
     switch (next_state) {
+        case TCPS_CLOSED:
         case TCPS_CLOSING:
         case TCPS_FIN_WAIT_2:
             tcp_state = next_state;
@@ -292,6 +618,7 @@ void stcp_tcp_sock::move_state_from_FIN_WAIT_1(tcpstate next_state)
 void stcp_tcp_sock::move_state_from_FIN_WAIT_2(tcpstate next_state)
 {
     switch (next_state) {
+        case TCPS_CLOSED:
         case TCPS_TIME_WAIT:
             tcp_state = next_state;
             break;
@@ -303,6 +630,7 @@ void stcp_tcp_sock::move_state_from_FIN_WAIT_2(tcpstate next_state)
 void stcp_tcp_sock::move_state_from_CLOSE_WAIT(tcpstate next_state)
 {
     switch (next_state) {
+        case TCPS_CLOSED:
         case TCPS_LAST_ACK:
             tcp_state = next_state;
             break;
@@ -314,6 +642,7 @@ void stcp_tcp_sock::move_state_from_CLOSE_WAIT(tcpstate next_state)
 void stcp_tcp_sock::move_state_from_CLOSING(tcpstate next_state)
 {
     switch (next_state) {
+        case TCPS_CLOSED:
         case TCPS_TIME_WAIT:
             tcp_state = next_state;
             break;
@@ -349,7 +678,7 @@ void stcp_tcp_sock::move_state_from_TIME_WAIT(tcpstate next_state)
 
 
 /*
- * msg: points ip_header
+ * msg: points ip_header, taken by the socket
  */
 void stcp_tcp_sock::rx_push(mbuf* msg,stcp_sockaddr_in* src)
 {
@@ -368,13 +697,13 @@ void stcp_tcp_sock::rx_push(mbuf* msg,stcp_sockaddr_in* src)
 
     switch (tcp_state) {
         case TCPS_CLOSED:
-            rx_push_CLOSED(mbuf_clone(msg, core::tcp.mp), src);
+            rx_push_CLOSED(msg, src);
             break;
         case TCPS_LISTEN:
-            rx_push_LISTEN(mbuf_clone(msg, core::tcp.mp), src);
+            rx_push_LISTEN(msg, src);
             break;
         case TCPS_SYN_SENT:
-            rx_push_SYN_SEND(mbuf_clone(msg, core::tcp.mp), src);
+            rx_push_SYN_SEND(msg, src);
             break;
         case TCPS_SYN_RCVD:
         case TCPS_ESTABLISHED:
@@ -384,13 +713,12 @@ void stcp_tcp_sock::rx_push(mbuf* msg,stcp_sockaddr_in* src)
         case TCPS_CLOSING:
         case TCPS_LAST_ACK:
         case TCPS_TIME_WAIT:
-            rx_push_ELSESTATE(mbuf_clone(msg, core::tcp.mp), src);
+            rx_push_ELSESTATE(msg, src);
             break;
         default:
             mbuf_free(msg);
             throw exception("OKASHII91934");
     }
-    mbuf_free(msg);
 }
 
 
@@ -430,6 +758,7 @@ void stcp_tcp_sock::rx_push_CLOSED(mbuf* msg, stcp_sockaddr_in* src)
 
 void stcp_tcp_sock::rx_push_LISTEN(mbuf* msg, stcp_sockaddr_in* src)
 {
+    UNUSED(src);
     tcpip* tih = mtod_tih(msg);
 
     /*
@@ -457,7 +786,14 @@ void stcp_tcp_sock::rx_push_LISTEN(mbuf* msg, stcp_sockaddr_in* src)
          *  - Securty Check
          *  - Priority Check
          */
-        stcp_tcp_sock* newsock = core::create_tcp_socket();
+        stcp_tcp_sock* newsock = nullptr;
+        if (wait_accept_count < max_connect)
+            newsock = core::tcp.sock_try_alloc();
+        if (newsock == nullptr) {
+            core::tcp.rx_syn_drop++;
+            mbuf_free(msg);
+            return;
+        }
         newsock->tcp_state = TCPS_SYN_RCVD;
         newsock->sock_state = SOCKS_WAITACCEPT;
         newsock->port      = port;
@@ -465,29 +801,26 @@ void stcp_tcp_sock::rx_push_LISTEN(mbuf* msg, stcp_sockaddr_in* src)
         newsock->si.iss_H(rand() % 0xffffffff);
         newsock->si.irs_N(tih->tcp.seq);
         newsock->parent = this;
-        stcp_printf("[%15p] open new connection from %p \n", newsock, this);
-
-        wait_accept_count ++;
-
         newsock->addr.sin_addr = tih->ip.dst;
         newsock->pair.sin_addr = tih->ip.src;
+        newsock->dst_cache.laddr = tih->ip.dst;
+        if (!core::tcp.conn_insert(newsock)) {
+            core::tcp.sock_free(newsock);
+            core::tcp.rx_syn_drop++;
+            mbuf_free(msg);
+            return;
+        }
+        stcp_printf("[%15p] open new connection from %p \n", newsock, this);
 
-        newsock->si.rcv_nxt_H(ntoh32(tih->tcp.seq) + 1);
-
-        swap_port(tih);
-        tih->tcp.seq     = newsock->si.iss_N();
-        tih->tcp.ack     = newsock->si.rcv_nxt_N();
-        tih->tcp.flags   = TCPF_SYN|TCPF_ACK;
-        tih->tcp.rx_win  = newsock->si.snd_win_N();
-        tih->tcp.urp     = 0x0000;
-        tih->tcp.cksum   = 0x0000;
-
-        tih->tcp.cksum   = cksum_tih(tih);
+        synq.push_back(newsock);
 
-        core::tcp.tx_push(msg, src);
+        newsock->si.rcv_nxt_H(ntoh32(tih->tcp.seq) + 1);
+        newsock->si.snd_una_H(newsock->si.iss_H());
+        newsock->si.snd_nxt_H(newsock->si.iss_H());
+        mbuf_free(msg);
 
-        newsock->si.snd_nxt_H(newsock->si.iss_H() + 1);
-        newsock->si.snd_una_N(newsock->si.iss_N());
+        /* resent until acked, dropped after tcp.rtx_max tries */
+        newsock->tx_ctl_rtx(TCPF_SYN|TCPF_ACK);
         return;
     }
 
@@ -506,14 +839,14 @@ void stcp_tcp_sock::rx_push_SYN_SEND(mbuf* msg, stcp_sockaddr_in* src)
      * 1: ACK Check
      */
     if (HAVE(tih, TCPF_ACK)) {
-        if (ntoh32(tih->tcp.ack) <= si.iss_H() ||
-                ntoh32(tih->tcp.ack) > si.snd_nxt_H()) {
+        if (seq_le(ntoh32(tih->tcp.ack), si.iss_H()) ||
+                seq_gt(ntoh32(tih->tcp.ack), si.snd_nxt_H())) {
             if (HAVE(tih, TCPF_RST)) {
                 swap_port(tih);
                 tih->tcp.seq   = tih->tcp.ack;
                 tih->tcp.flags = TCPF_RST;
 
-                core::tcp.tx_push(msg, src);
+                core::tcp.tx_push(msg, src, &dst_cache);
             } else {
                 mbuf_free(msg);
             }
@@ -562,7 +895,7 @@ void stcp_tcp_sock::rx_push_SYN_SEND(mbuf* msg, stcp_sockaddr_in* src)
             tih->tcp.ack   = si.rcv_nxt_N();
             tih->tcp.flags = TCPF_SYN|TCPF_ACK;
         }
-        core::tcp.tx_push(msg, src);
+        core::tcp.tx_push(msg, src, &dst_cache);
         return;
     }
 
@@ -590,41 +923,108 @@ void stcp_tcp_sock::rx_push_SYN_SEND(mbuf* msg, stcp_sockaddr_in* src)
  * - TCPS_CLOSING:
  * - TCPS_LAST_ACK:
  * - TCPS_TIME_WAIT:
+ *
+ * The checks share msg and read the segment from seg,
+ * which is taken before any of them touches the headers.
+ * A check taking msg (queued or sent) sets it to nullptr.
  */
 void stcp_tcp_sock::rx_push_ELSESTATE(mbuf* msg, stcp_sockaddr_in* src)
 {
-    if (!rx_push_ES_seqchk(mbuf_clone(msg, core::tcp.mp), src))  goto drop_packet;
-    if (!rx_push_ES_rstchk(mbuf_clone(msg, core::tcp.mp), src))  goto drop_packet;
+    tcp_seg seg(mtod_tih(msg));
+
+    if (!rx_push_ES_seqchk(msg, seg, src))  goto drop_packet;
+    if (!rx_push_ES_rstchk(msg, seg, src))  goto drop_packet;
 
     /*
      * 3: Securty and Priority Check
      * TODO: not implement yet
      */
 
-    if (!rx_push_ES_synchk(mbuf_clone(msg, core::tcp.mp), src))  goto drop_packet;
-    if (!rx_push_ES_ackchk(mbuf_clone(msg, core::tcp.mp), src))  goto drop_packet;
+    if (!rx_push_ES_synchk(msg, seg, src))  goto drop_packet;
+    if (!rx_push_ES_ackchk(msg, seg, src))  goto drop_packet;
 
     /*
      * 6: URG Check
      * TODO: not implement yet
      */
 
-    if (!rx_push_ES_textseg(mbuf_clone(msg, core::tcp.mp), src)) goto drop_packet;
-    if (!rx_push_ES_finchk( mbuf_clone(msg, core::tcp.mp), src)) goto drop_packet;
+    if (!rx_push_ES_textseg(msg, seg, src)) goto drop_packet;
+    if (!rx_push_ES_finchk( msg, seg, src)) goto drop_packet;
 
 drop_packet:
-    mbuf_free(msg);
+    if (msg != nullptr)
+        mbuf_free(msg);
+}
 
+
+/*
+ * Sends a segment without data, carrying flags
+ * and the current snd_nxt/rcv_nxt, in a fresh mbuf.
+ */
+void stcp_tcp_sock::tx_ctl(uint8_t flags, const stcp_sockaddr_in* dst)
+{
+    tx_ctl(flags, dst, si.snd_nxt_H());
+}
+
+void stcp_tcp_sock::tx_ctl(uint8_t flags, const stcp_sockaddr_in* dst, uint32_t seq)
+{
+    mbuf* msg = mbuf_alloc(core::tcp.pool());
+    tcpip* tih = reinterpret_cast<tcpip*>(mbuf_push(msg, sizeof(tcpip)));
+    hdr_fill(tih, seq, flags, 0, dst);
+    core::tcp.tx_push(msg, dst, &dst_cache);
 }
 
 
 /*
- * 1: Sequence Number Check
+ * Sends a SYN or FIN at snd_nxt, which it takes one of,
+ * and keeps it as rtx_ctl under the retransmission timer.
  */
-bool stcp_tcp_sock::rx_push_ES_seqchk(mbuf* msg, stcp_sockaddr_in* src)
+void stcp_tcp_sock::tx_ctl_rtx(uint8_t flags)
+{
+    uint32_t seq = si.snd_nxt_H();
+    if (rtx_empty())
+        rtx_seq = seq;
+    rtx_ctl = flags;
+    if (rtt_start == 0) {
+        rtt_seq   = seq;
+        rtt_start = rdtsc();
+    }
+
+    tx_ctl(flags, &pair, seq);
+    si.snd_nxt_H(seq + 1);
+    if (rto_expire == 0)
+        rto_arm();
+}
+
+
+/*
+ * Answers with RST reusing msg, which is taken.
+ */
+void stcp_tcp_sock::tx_rst(mbuf*& msg, const tcp_seg& seg, stcp_sockaddr_in* src)
 {
-    UNUSED(src);
     tcpip* tih = mtod_tih(msg);
+    swap_port(tih);
+    tih->tcp.seq   = hton32(seg.ack);
+    tih->tcp.flags = TCPF_RST;
+    core::tcp.tx_push(msg, src, &dst_cache);
+    msg = nullptr;
+}
+
+
+/*
+ * 1: Sequence Number Check
+ * An unacceptable segment is answered with an ACK
+ * of rcv_nxt unless it is a RST (RFC 793).
+ */
+bool stcp_tcp_sock::rx_push_ES_seqchk(mbuf*& msg, const tcp_seg& seg, stcp_sockaddr_in* src)
+{
+    /* our SYN-ACK was lost and the peer sent its SYN again */
+    if (tcp_state == TCPS_SYN_RCVD && seg.has(TCPF_SYN)
+            && seg.seq == si.irs_H() && !rtx_empty()) {
+        rtx_head();
+        return false;
+    }
+
     switch (tcp_state) {
 
         case TCPS_SYN_RCVD:
@@ -637,36 +1037,31 @@ bool stcp_tcp_sock::rx_push_ES_seqchk(mbuf* msg, stcp_sockaddr_in* src)
         case TCPS_TIME_WAIT:
         {
             bool pass = false;
-            if (data_len(tih) == 0) {
-                if (tih->tcp.rx_win == 0) {
-                    if (tih->tcp.seq == si.rcv_nxt_N()) {
+            if (seg.dlen == 0) {
+                if (seg.win == 0) {
+                    if (seg.seq == si.rcv_nxt_H()) {
                         pass = true;
                     }
                 } else { /* win > 0 */
-                    if (si.rcv_nxt_H() <= ntoh32(tih->tcp.seq)
-                        && ntoh32(tih->tcp.seq) <= si.rcv_nxt_H()+si.rcv_win_H()) {
+                    if (seq_le(si.rcv_nxt_H(), seg.seq)
+                        && seq_le(seg.seq, si.rcv_nxt_H()+si.rcv_win_H())) {
                         pass = true;
                     }
                 }
             } else { /* data_len > 0 */
-                if (tih->tcp.rx_win > 0) {
-                    uint32_t seq  = ntoh32(tih->tcp.seq);
+                if (seg.win > 0) {
                     uint32_t rnxt = si.rcv_nxt_H();
                     uint32_t rwin = si.rcv_win_H();
-                    uint32_t seqdlen = seq+data_len(tih)-1;
+                    uint32_t seqdlen = seg.seq+seg.dlen-1;
 
-                    bool cond1 = (rnxt <= seq) && (seq <= rnxt + rwin);
-                    bool cond2 = rnxt <= seqdlen && seqdlen < rnxt + rwin;
+                    bool cond1 = seq_le(rnxt, seg.seq) && seq_le(seg.seq, rnxt + rwin);
+                    bool cond2 = seq_le(rnxt, seqdlen) && seq_lt(seqdlen, rnxt + rwin);
                     pass = cond1 || cond2;
                 }
             }
-
-            if (!pass) {
-                mbuf_free(msg);
-                return false;
-            }
-
-            break;
+            if (!pass && !seg.has(TCPF_RST))
+                tx_ctl(TCPF_ACK, src);
+            return pass;
         }
 
         case TCPS_CLOSED:
@@ -678,24 +1073,20 @@ bool stcp_tcp_sock::rx_push_ES_seqchk(mbuf* msg, stcp_sockaddr_in* src)
             mbuf_free(msg);
             throw exception("OKASHII334: unknown state");
     }
-    mbuf_free(msg);
-    return true;
 }
 
 
 /*
  * 2: TCPF_RST Check
  */
-bool stcp_tcp_sock::rx_push_ES_rstchk(mbuf* msg, stcp_sockaddr_in* src)
+bool stcp_tcp_sock::rx_push_ES_rstchk(mbuf*& msg, const tcp_seg& seg, stcp_sockaddr_in* src)
 {
     UNUSED(src);
-    tcpip* tih = mtod_tih(msg);
     switch (tcp_state) {
         case TCPS_SYN_RCVD:
         {
-            if (HAVE(tih, TCPF_RST)) {
+            if (seg.has(TCPF_RST)) {
                 stcp_printf("conection reset\n");
-                mbuf_free(msg);
                 move_state(TCPS_CLOSED);
                 return false;
             }
@@ -707,9 +1098,8 @@ bool stcp_tcp_sock::rx_push_ES_rstchk(mbuf* msg, stcp_sockaddr_in* src)
         case TCPS_FIN_WAIT_2:
         case TCPS_CLOSE_WAIT:
         {
-            if (HAVE(tih, TCPF_RST)) {
+            if (seg.has(TCPF_RST)) {
                 stcp_printf("conection reset\n");
-                mbuf_free(msg);
                 move_state(TCPS_CLOSED);
                 return false;
             }
@@ -720,8 +1110,7 @@ bool stcp_tcp_sock::rx_push_ES_rstchk(mbuf* msg, stcp_sockaddr_in* src)
         case TCPS_LAST_ACK:
         case TCPS_TIME_WAIT:
         {
-            if (HAVE(tih, TCPF_RST)) {
-                mbuf_free(msg);
+            if (seg.has(TCPF_RST)) {
                 move_state(TCPS_CLOSED);
                 return false;
             }
@@ -737,7 +1126,6 @@ bool stcp_tcp_sock::rx_push_ES_rstchk(mbuf* msg, stcp_sockaddr_in* src)
             mbuf_free(msg);
             throw exception("OKASHII883: unknown state");
     }
-    mbuf_free(msg);
     return true;
 }
 
@@ -745,10 +1133,9 @@ bool stcp_tcp_sock::rx_push_ES_rstchk(mbuf* msg, stcp_sockaddr_in* src)
 /*
  * 4: TCPF_SYN Check
  */
-bool stcp_tcp_sock::rx_push_ES_synchk(mbuf* msg, stcp_sockaddr_in* src)
+bool stcp_tcp_sock::rx_push_ES_synchk(mbuf*& msg, const tcp_seg& seg, stcp_sockaddr_in* src)
 {
     UNUSED(src);
-    tcpip* tih = mtod_tih(msg);
     switch (tcp_state) {
         case TCPS_SYN_RCVD:
         case TCPS_ESTABLISHED:
@@ -759,9 +1146,8 @@ bool stcp_tcp_sock::rx_push_ES_synchk(mbuf* msg, stcp_sockaddr_in* src)
         case TCPS_LAST_ACK:
         case TCPS_TIME_WAIT:
         {
-            if (HAVE(tih, TCPF_SYN)) {
+            if (seg.has(TCPF_SYN)) {
                 stcp_printf("conection reset\n");
-                mbuf_free(msg);
                 move_state(TCPS_CLOSED);
                 return false;
             }
@@ -777,7 +1163,6 @@ bool stcp_tcp_sock::rx_push_ES_synchk(mbuf* msg, stcp_sockaddr_in* src)
             mbuf_free(msg);
             throw exception("OKASHII199: unknown state");
     }
-    mbuf_free(msg);
     return true;
 }
 
@@ -785,145 +1170,132 @@ bool stcp_tcp_sock::rx_push_ES_synchk(mbuf* msg, stcp_sockaddr_in* src)
 /*
  * 5: TCPF_ACK Check
  */
-bool stcp_tcp_sock::rx_push_ES_ackchk(mbuf* msg, stcp_sockaddr_in* src)
+bool stcp_tcp_sock::rx_push_ES_ackchk(mbuf*& msg, const tcp_seg& seg, stcp_sockaddr_in* src)
 {
-    tcpip* tih = mtod_tih(msg);
-    if (HAVE(tih, TCPF_ACK)) {
-        switch (tcp_state) {
-            case TCPS_SYN_RCVD:
-            {
-                if (si.snd_una_H() <= ntoh32(tih->tcp.ack) &&
-                        ntoh32(tih->tcp.ack) <= si.snd_nxt_H()) {
-                    move_state(TCPS_ESTABLISHED);
-                    mbuf_free(msg);
-                } else {
-                    swap_port(tih);
-                    tih->tcp.seq   = tih->tcp.ack;
-                    tih->tcp.flags = TCPF_RST;
-                    core::tcp.tx_push(msg, src);
-                }
-                return false;
-                break;
-            }
-
-            case TCPS_ESTABLISHED:
-            case TCPS_CLOSE_WAIT:
-            case TCPS_CLOSING:
-            {
-                if (si.snd_una_H() < tih->tcp.ack && tih->tcp.ack <= si.snd_nxt_H()) {
-                    si.snd_una_N(tih->tcp.ack);
-                }
-
-                if (ntoh32(tih->tcp.ack) < si.snd_una_H()) {
-                    swap_port(tih);
-                    tih->tcp.seq   = tih->tcp.ack;
-                    tih->tcp.flags = TCPF_RST;
+    if (!seg.has(TCPF_ACK))
+        return false;
 
-                    core::tcp.tx_push(msg, src);
-                    return false;
-                }
+    switch (tcp_state) {
+        case TCPS_SYN_RCVD:
+        {
+            if (seq_lt(si.snd_una_H(), seg.ack) && seq_le(seg.ack, si.snd_nxt_H())) {
+                si.snd_una_H(seg.ack);
+                rtx_acked(seg.ack);
+                move_state(TCPS_ESTABLISHED);
+                if (sock_state == SOCKS_WAITACCEPT && parent != nullptr)
+                    parent->accept_ready(this);
+            } else {
+                tx_rst(msg, seg, src);
+            }
+            return false;
+        }
 
-                if (si.snd_una_H() < ntoh32(tih->tcp.ack) &&
-                        ntoh32(tih->tcp.ack) <= si.snd_nxt_H()) {
-                    if ((si.snd_wl1_H() < ntoh32(tih->tcp.seq))
-                            || (si.snd_wl1_N() == tih->tcp.seq)
-                            || (si.snd_wl2_N() == tih->tcp.ack)) {
-                        si.snd_win_N(tih->tcp.rx_win );
-                        si.snd_wl1_N(tih->tcp.seq);
-                        si.snd_wl2_N(tih->tcp.ack);
-                    }
-                }
+        case TCPS_ESTABLISHED:
+        case TCPS_FIN_WAIT_1:
+        case TCPS_FIN_WAIT_2:
+        case TCPS_CLOSE_WAIT:
+        case TCPS_CLOSING:
+        case TCPS_LAST_ACK:
+        {
+            /*
+             * An ACK of data not sent yet is answered and dropped,
+             * an older duplicate is ignored (RFC 793).
+             */
+            if (seq_lt(si.snd_una_H(), seg.ack) && seq_le(seg.ack, si.snd_nxt_H())) {
+                si.snd_una_H(seg.ack);
+                rtx_acked(seg.ack);
+            } else if (seq_gt(seg.ack, si.snd_nxt_H())) {
+                tx_ctl(TCPF_ACK, src);
+                return false;
+            } else if (seg.ack == si.snd_una_H() && seg.dlen == 0
+                    && !seg.has(TCPF_FIN) && !rtx_empty()) {
+                rtx_dupack();
+            }
 
-                if (tcp_state == TCPS_CLOSING) {
-                    if (si.snd_nxt_H() <= ntoh32(tih->tcp.ack)) {
-                        move_state(TCPS_TIME_WAIT);
-                    }
+            /* SND.UNA =< SEG.ACK =< SND.NXT, una is updated above */
+            if (seq_le(si.snd_una_H(), seg.ack) && seq_le(seg.ack, si.snd_nxt_H())) {
+                if (seq_lt(si.snd_wl1_H(), seg.seq)
+                        || (si.snd_wl1_H() == seg.seq && seq_le(si.snd_wl2_H(), seg.ack))) {
+                    si.snd_win_H(seg.win);
+                    si.snd_wl1_H(seg.seq);
+                    si.snd_wl2_H(seg.ack);
                 }
-                break;
             }
 
-            case TCPS_FIN_WAIT_1:
-            {
-                move_state(TCPS_FIN_WAIT_2);
-                break;
-            }
-            case TCPS_FIN_WAIT_2:
-            {
-                printf("OK\n");
-                break;
-            }
-            case TCPS_LAST_ACK:
-            {
-                if (si.snd_nxt_H() <= ntoh32(tih->tcp.ack)) {
+            /*
+             * Our FIN is acked once everything up to
+             * snd_nxt is, see rx_push_ES_finchk().
+             */
+            bool fin_acked = (seg.ack == si.snd_nxt_H());
+            if (tcp_state == TCPS_FIN_WAIT_1) {
+                if (fin_acked)
+                    move_state(TCPS_FIN_WAIT_2);
+            } else if (tcp_state == TCPS_CLOSING) {
+                if (fin_acked)
+                    move_state(TCPS_TIME_WAIT);
+            } else if (tcp_state == TCPS_LAST_ACK) {
+                if (fin_acked) {
                     move_state(TCPS_CLOSED);
-                    mbuf_free(msg);
                     return false;
                 }
-                break;
-            }
-            case TCPS_TIME_WAIT:
-            {
-                mbuf_free(msg);
-                throw exception("TODO: NOT IMPEL YET");
-                break;
             }
-
-            case TCPS_CLOSED:
-            case TCPS_LISTEN:
-            case TCPS_SYN_SENT:
-                mbuf_free(msg);
-                throw exception("OKASHII1941");
-            default:
-                mbuf_free(msg);
-                throw exception("OKASHII14001: unknown state");
+            break;
         }
-        mbuf_free(msg);
-        return true;
-    } else {
-        mbuf_free(msg);
-        return false;
+        case TCPS_TIME_WAIT:
+        {
+            mbuf_free(msg);
+            throw exception("TODO: NOT IMPEL YET");
+            break;
+        }
+
+        case TCPS_CLOSED:
+        case TCPS_LISTEN:
+        case TCPS_SYN_SENT:
+            mbuf_free(msg);
+            throw exception("OKASHII1941");
+        default:
+            mbuf_free(msg);
+            throw exception("OKASHII14001: unknown state");
     }
+    return true;
 }
 
 
 /*
  * 7: Text Segment Control
+ * msg itself goes to rxq with the headers pulled.
+ * A FIN in the same segment is acked by finchk.
+ *
+ * Only data starting at rcv_nxt is taken, a retransmit
+ * overlapping it loses the part received already. A segment
+ * past rcv_nxt (lost one before it) is dropped and answered
+ * with an ACK of rcv_nxt, the duplicate ACK the peer's fast
+ * retransmit counts. There is no reassembly queue.
  */
-bool stcp_tcp_sock::rx_push_ES_textseg(mbuf* msg, stcp_sockaddr_in* src)
+bool stcp_tcp_sock::rx_push_ES_textseg(mbuf*& msg, const tcp_seg& seg, stcp_sockaddr_in* src)
 {
-    UNUSED(src);
-    tcpip* tih = mtod_tih(msg);
+    if ((seg.dlen > 0 || seg.has(TCPF_FIN)) && seq_gt(seg.seq, si.rcv_nxt_H())) {
+        core::tcp.rx_ooo++;
+        tx_ctl(TCPF_ACK, src);
+        return false;
+    }
+
+    if (seg.dlen > 0) {
+        /* < dlen, seqchk passed the end of it */
+        uint32_t skip = si.rcv_nxt_H() - seg.seq;
 
-    if (data_len(tih) > 0) {
         switch (tcp_state) {
             case TCPS_ESTABLISHED:
             case TCPS_FIN_WAIT_1:
             case TCPS_FIN_WAIT_2:
             {
-                mbuf* msg_to_enq_sock = mbuf_clone(msg, core::tcp.mp);
-                mbuf_pull(msg_to_enq_sock, sizeof(stcp_ip_header));
-                uint16_t tcphlen  = ((tih->tcp.data_off>>4)<<2);
-                mbuf_pull(msg_to_enq_sock, tcphlen);
-                rxq.push(msg_to_enq_sock);
+                mbuf_pull(msg, seg.hlen + skip);
+                rxq.push(msg);
+                msg = nullptr;
 
-                si.rcv_nxt_inc_H(data_len(tih));
-                mbuf_trim(msg, data_len(tih));
-
-                tih->ip.dst = tih->ip.src;
-                tih->ip.src = addr.sin_addr;
-                tih->ip.next_proto_id = STCP_IPPROTO_TCP;
-                tih->ip.total_length  = hton16(mbuf_pkt_len(msg));
-
-                swap_port(tih);
-                tih->tcp.seq    = si.snd_nxt_N();
-                tih->tcp.ack    = si.rcv_nxt_N();
-                tih->tcp.flags  = TCPF_ACK;
-                tih->tcp.rx_win = si.snd_win_N();
-                tih->tcp.urp    = 0x0000;
-                tih->tcp.cksum  = 0x0000;
-
-                tih->tcp.cksum   = cksum_tih(tih);
-                core::tcp.tx_push(msg, src);
+                si.rcv_nxt_inc_H(seg.dlen - skip);
+                if (!seg.has(TCPF_FIN))
+                    tx_ctl(TCPF_ACK, src);
                 break;
             }
 
@@ -945,8 +1317,6 @@ bool stcp_tcp_sock::rx_push_ES_textseg(mbuf* msg, stcp_sockaddr_in* src)
                 mbuf_free(msg);
                 throw exception("OKASHII19491: unknown state");
         }
-    } else {
-        mbuf_free(msg);
     }
     return true;
 }
@@ -955,16 +1325,13 @@ bool stcp_tcp_sock::rx_push_ES_textseg(mbuf* msg, stcp_sockaddr_in* src)
 /*
  * 8: TCPF_FIN Check
  */
-bool stcp_tcp_sock::rx_push_ES_finchk(mbuf* msg, stcp_sockaddr_in* src)
+bool stcp_tcp_sock::rx_push_ES_finchk(mbuf*& msg, const tcp_seg& seg, stcp_sockaddr_in* src)
 {
-    UNUSED(src);
-    tcpip* tih = mtod_tih(msg);
-    if (HAVE(tih, TCPF_FIN)) {
+    if (seg.has(TCPF_FIN)) {
         switch (tcp_state) {
             case TCPS_CLOSED:
             case TCPS_LISTEN:
             case TCPS_SYN_SENT:
-                mbuf_free(msg);
                 return false;
                 break;
             case TCPS_SYN_RCVD:
@@ -987,31 +1354,21 @@ bool stcp_tcp_sock::rx_push_ES_finchk(mbuf* msg, stcp_sockaddr_in* src)
                 break;
 
             default:
-                mbuf_free(msg);
+                if (msg != nullptr)
+                    mbuf_free(msg);
                 throw exception("OKASHII939201: unknown state");
         }
         stcp_printf("[%15p] connection closing\n", this);
-        si.rcv_nxt_H(ntoh32(tih->tcp.seq) + 1);
-
-        swap_port(tih);
-        tih->tcp.seq = si.snd_nxt_N();
-        tih->tcp.ack = si.rcv_nxt_N();
+        si.rcv_nxt_H(seg.seq + seg.dlen + 1);
 
         if (tcp_state == TCPS_CLOSE_WAIT) {
-            tih->tcp.flags = TCPF_ACK|TCPF_FIN;
+            proc(); /* what the app wrote goes before the FIN */
+            tx_ctl_rtx(TCPF_ACK|TCPF_FIN);
             move_state(TCPS_LAST_ACK);
         } else {
-            tih->tcp.flags = TCPF_ACK;
+            tx_ctl(TCPF_ACK, src);
         }
-
-        tih->tcp.cksum    = 0x0000;
-        tih->tcp.urp      = 0x0000;
-
-        tih->tcp.cksum = cksum_tih(tih);
-        core::tcp.tx_push(mbuf_clone(msg, core::tcp.mp), src);
-
     }
-    mbuf_free(msg);
     return true;
 }
 
@@ -1028,14 +1385,17 @@ void stcp_tcp_sock::print_stat(size_t rootx, size_t rooty) const
     switch (tcp_state) {
         case TCPS_LISTEN:
             core::screen.printwln("  - local  port: %u", ntoh16(port));
-            core::screen.printwln("  - wait accept count: %zd", wait_accept_count);
+            core::screen.printwln("  - wait accept/half-open: %zd/%zd",
+                    wait_accept_count.load(), synq.size);
             break;
         case TCPS_ESTABLISHED:
             core::screen.printwln("  - local/remote: %s:%u/%s:%u",
                     addr.c_str(), ntoh16(port), pair.c_str(), ntoh16(pair_port));
-            core::screen.printwln("  - txq/rxq: %zd/%zd",rxq.size(), txq.size());
+            core::screen.printwln("  - txq/rxq/rtxq: %zd/%zd/%zd",
+                    txq.size(), rxq.size(), rtxq.size());
             core::screen.printwln("  - iss/irs        : %u/%u", si.iss_H(), si.irs_H());
-            core::screen.printwln("  - snd_una        : %u", si.snd_una_H());
+            core::screen.printwln("  - snd_una        : %u srtt/rto: %u/%uus",
+                    si.snd_una_H(), srtt, rto);
             core::screen.printwln("  - snd_nxt/rcv_nxt: %u/%u", si.snd_nxt_H(), si.rcv_nxt_H());
             core::screen.printwln("  - snd_win/rcv_win: %u/%u", si.snd_win_H(), si.rcv_win_H());
             core::screen.printwln("  - snd_wl1/wl2    : %u/%u", si.snd_wl1_H(), si.snd_wl2_H());
@@ -26,13 +26,23 @@ void stcp_udp_sock::sendto(mbuf* msg, const stcp_sockaddr_in* dst)
 {
     stcp_udp_sockdata d(msg, *dst);
     txq.push(d);
+    tx_kick();
+}
+
+void stcp_udp_sock::tx_kick()
+{
+    if (!tx_pending.exchange(true))
+        core::udp.tx_work.push(this);
 }
 
 void stcp_udp_sock::proc()
 {
     while (!txq.empty()) {
+        stcp_udp_sockdata head = txq.front();
+        if (core::ip.tx_throttled(&head.addr, &dst_cache)) break;
+
         stcp_udp_sockdata d = txq.pop();
-        core::udp.tx_push(d.msg, &d.addr, port);
+        core::udp.tx_push(d.msg, &d.addr, port, &dst_cache);
     }
 }
 
@@ -41,6 +51,8 @@ void stcp_udp_sock::bind(const stcp_sockaddr_in* a)
     addr = a->sin_addr;
     port = a->sin_port;
     state = binded;
+    dst_cache = ip_dst_cache();
+    dst_cache.laddr = addr;
 }
 
 
@@ -50,7 +62,7 @@ void stcp_udp_sock::bind(const stcp_sockaddr_in* a)
  * dstp: Destination port as NetworkByteOrder
  */
 void udp_module::tx_push(mbuf* msg,
-        const stcp_sockaddr_in* dst, uint16_t srcp)
+        const stcp_sockaddr_in* dst, uint16_t srcp, ip_dst_cache* dc)
 {
     uint16_t udplen = mbuf_pkt_len(msg);
 
@@ -59,9 +71,17 @@ void udp_module::tx_push(mbuf* msg,
     uh->sport = srcp;
     uh->dport = dst->sin_port;
     uh->len   = hton16(sizeof(stcp_udp_header) + udplen);
-    uh->cksum = 0x0000;
+    uh->cksum = 0x0000; /* filled by ip_module */
 
-    core::ip.tx_push(msg, dst, STCP_IPPROTO_UDP);
+    core::ip.tx_push(msg, dst, STCP_IPPROTO_UDP, dc);
+}
+
+
+void udp_module::rx_burst(mbuf** msgs, stcp_sockaddr_in* srcs, uint16_t nb_msgs)
+{
+    for (uint16_t i=0; i<nb_msgs; i++) {
+        rx_push(msgs[i], &srcs[i]);
+    }
 }
 
 
@@ -108,11 +128,17 @@ void udp_module::print_stat() const
     }
 }
 
+/*
+ * Same as tcp_module::proc(), only sockets on tx_work.
+ */
 void udp_module::proc()
 {
-    for (stcp_udp_sock* sock : socks) {
-        sock->proc();
-    }
+    tx_work.drain([](stcp_udp_sock* s) {
+        s->tx_pending = false;
+        s->proc();
+        if (!s->txq.empty())
+            s->tx_kick();
+    });
 }
 
 
@@ -17,6 +17,7 @@ const stcp_in_addr    stcp_in_addr::zero(0x00, 0x00, 0x00, 0x00);
 
 
 std::vector<stcp_usrapp_info> core::lapps;
+std::mutex   core::stack_lock;
 tcp_module   core::tcp;
 udp_module   core::udp;
 icmp_module  core::icmp;
@@ -24,6 +25,7 @@ ip_module    core::ip;
 arp_module   core::arp;
 ether_module core::ether;
 dataplane    core::dplane;
+tuning_params core::tune;
 
 ncurses      core::screen;
 filefd       core::stcp_stdout;
@@ -65,26 +67,20 @@ void core::set_app(stcp_usrapp func_ptr, void* func_arg)
 
 
 
+/*
+ * Called from user apps, the socket pool
+ * is shared with the polling lcores.
+ */
 stcp_tcp_sock* core::create_tcp_socket()
 {
-    for (stcp_tcp_sock& s : tcp.socks) {
-        if (s.sock_state == SOCKS_UNUSE) {
-            s.init();
-            s.sock_state = SOCKS_USE;
-            return &s;
-        }
-    }
-
-    /*
-     * TODO reserve socks.
-     */
-    throw exception("NO SOCKET SPACE");
+    std::lock_guard<std::mutex> lg(stack_lock);
+    return tcp.sock_alloc();
 }
 
 void core::destroy_tcp_socket(stcp_tcp_sock* sock)
 {
-    sock->term();
-    sock->sock_state = SOCKS_UNUSE;
+    std::lock_guard<std::mutex> lg(stack_lock);
+    tcp.sock_free(sock);
 }
 
 
@@ -171,8 +167,17 @@ void core::set_default_gw(uint8_t o1, uint8_t o2, uint8_t o3, uint8_t o4, uint8_
 
 
 
-void core::set_ip_addr(uint8_t o1, uint8_t o2, uint8_t o3, uint8_t o4, uint8_t cidr)
+uint8_t core::add_vlan(uint8_t port, uint16_t vid)
+{
+    return dplane.add_vlan(port, vid);
+}
+
+
+void core::set_ip_addr(uint8_t o1, uint8_t o2, uint8_t o3, uint8_t o4, uint8_t cidr, uint8_t port)
 {
+    if (port >= dplane.devices.size())
+        throw exception("set_ip_addr: no such interface");
+
 
     /*
      * Set IP address
@@ -181,7 +186,7 @@ void core::set_ip_addr(uint8_t o1, uint8_t o2, uint8_t o3, uint8_t o4, uint8_t c
     memset(&ifr, 0, sizeof ifr);
     struct stcp_sockaddr_in* sin = reinterpret_cast<stcp_sockaddr_in*>(&ifr.if_addr);
     sin->sin_addr.set(o1, o2, o3, o4);
-    dplane.devices[0].ioctl(STCP_SIOCSIFADDR, &ifr);
+    dplane.devices[port].ioctl(STCP_SIOCSIFADDR, &ifr);
 
 
     /*
@@ -201,7 +206,20 @@ void core::set_ip_addr(uint8_t o1, uint8_t o2, uint8_t o3, uint8_t o4, uint8_t c
     memset(&ifr, 0, sizeof ifr);
     sin = reinterpret_cast<stcp_sockaddr_in*>(&ifr.if_addr);
     sin->sin_addr.set(U.u8[0], U.u8[1], U.u8[2], U.u8[3]);
-    dplane.devices[0].ioctl(STCP_SIOCSIFNETMASK, &ifr);
+    dplane.devices[port].ioctl(STCP_SIOCSIFNETMASK, &ifr);
+}
+
+
+void core::add_ip_addr(uint8_t o1, uint8_t o2, uint8_t o3, uint8_t o4, uint8_t port)
+{
+    if (port >= dplane.devices.size())
+        throw exception("add_ip_addr: no such interface");
+
+    struct stcp_ifreq ifr;
+    memset(&ifr, 0, sizeof ifr);
+    struct stcp_sockaddr_in* sin = reinterpret_cast<stcp_sockaddr_in*>(&ifr.if_addr);
+    sin->sin_addr.set(o1, o2, o3, o4);
+    dplane.devices[port].ioctl(STCP_SIOCAIFADDR, &ifr);
 }
 
 
@@ -230,30 +248,45 @@ void core::init(int argc, char** argv)
 # error "unknown runlevel"
 #endif
 
+    const char* conf = getenv("STCP_CONF");
+    tune.load(conf != nullptr ? conf : ST_CONF_PATH);
+
     dplane.init(argc, argv);
     arp.init();
     ip.init();
     tcp.init();
 }
 
-void core::ifs_proc()
+void core::ifs_proc(uint16_t qid)
 {
+    uint64_t now = rdtsc();
     for (ifnet& dev : dplane.devices) {
-        uint16_t num_reqest_to_send = dev.tx_size();
-        uint16_t num_tx = dev.io_tx(num_reqest_to_send);
-
-        if (num_tx != num_reqest_to_send) {
-            throw exception("core::ifs_proc(): num_tx!=num_reqest_to_send, Oh yeah!");
+        if (dev.is_vlan()) continue; /* polled through the parent */
+        if (dev.tx_drain_due(qid, now)) {
+            dev.io_tx(qid, dev.tx_size(qid));
         }
 
-        uint16_t num_rx = dev.io_rx();
+        mbuf* bufs[BURST_SIZE];
+        uint16_t num_rx = dev.io_rx(qid, bufs, tune.burst_size);
         if (unlikely(num_rx == 0)) continue;
 
-        while (!dev.rx_empty()) {
-            mbuf* msg = dev.rx_pop();
-            ether.rx_push(msg);
-        }
+        std::lock_guard<std::mutex> lg(stack_lock);
+        ether.rx_burst(bufs, num_rx);
+    }
+}
+
+
+/*
+ * Run-to-completion loop of the lcores polling queue 1..N-1.
+ * Queue 0 is polled by the master lcore in core::run().
+ */
+int core::queue_loop(void* arg)
+{
+    uint16_t qid = static_cast<uint16_t>(reinterpret_cast<uintptr_t>(arg));
+    while (true) {
+        ifs_proc(qid);
     }
+    return 0;
 }
 
 void core::run()
@@ -265,16 +298,47 @@ void core::run()
 # error "unknown runlevel"
 #endif
 
+    dplane.start();
     for (stcp_usrapp_info& app : lapps) {
         rte::eal_remote_launch(
                 usrapp_wrap, reinterpret_cast<void*>(&app), app.lcore_id);
     }
 
+    /*
+     * Polling lcores are taken from the lcores left after user
+     * apps, those on the node holding the ports first.
+     */
+    std::vector<unsigned> free_lcores;
+    for (int pass=0; pass<2; pass++) {
+        for (unsigned lcore_id=lapps.size()+1; lcore_id<RTE_MAX_LCORE; lcore_id++) {
+            if (!rte::lcore_is_enabled(lcore_id))
+                continue;
+            bool local = (int)rte::lcore_to_socket_id(lcore_id) == dplane.poll_socket();
+            if (local == (pass == 0))
+                free_lcores.push_back(lcore_id);
+        }
+    }
+    for (uint16_t qid=1; qid<dplane.nb_queues(); qid++) {
+        if (free_lcores.size() < qid) {
+            std::string errstr = "no lcore to poll queue " + std::to_string(qid);
+            throw exception(errstr.c_str());
+        }
+        unsigned lcore_id = free_lcores[qid-1];
+        dplane.bind_lcore(lcore_id, qid);
+        rte::eal_remote_launch(queue_loop,
+                reinterpret_cast<void*>(static_cast<uintptr_t>(qid)), lcore_id);
+    }
+    dplane.bind_lcore(rte::lcore_id(), 0);
+
     while (true) {
-        ifs_proc();
-        ether.proc();
-        tcp.proc();
-        udp.proc();
+        ifs_proc(0);
+        {
+            std::lock_guard<std::mutex> lg(stack_lock);
+            arp.proc();
+            ip.proc();
+            tcp.proc();
+            udp.proc();
+        }
 
 #if ST_RUNLEVEL==RUNLEV_DEBUG
         core::stat_all();
@@ -0,0 +1,160 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <string>
+#include <stcp/tuning.h>
+#include <stcp/ifnet.h>
+#include <stcp/exception.h>
+
+
+namespace stcp {
+
+
+static std::string strip(const std::string& s)
+{
+    size_t b = 0;
+    size_t e = s.size();
+    while (b < e && isspace(s[b]))   b++;
+    while (e > b && isspace(s[e-1])) e--;
+    return s.substr(b, e-b);
+}
+
+
+template <class T>
+static void set_uint(T* dst, const std::string& key, const std::string& val)
+{
+    char* end;
+    errno = 0;
+    unsigned long long n = strtoull(val.c_str(), &end, 0);
+    if (val.empty() || *end != '\0' || errno != 0 || n > T(~T(0))) {
+        std::string errstr = "tuning: bad value for " + key + ": " + val;
+        throw exception(errstr.c_str());
+    }
+    *dst = static_cast<T>(n);
+}
+
+
+/*
+ * Ini file, one "key = value" per line under [section],
+ * '#' or ';' starts a comment. e.g.
+ *
+ *   [dataplane]
+ *   nb_rxtx_queues = 4
+ *   rx_ring_size   = 1024
+ *
+ *   [tcp]
+ *   nb_socket_alloc = 64
+ *
+ * A missing file keeps the defaults,
+ * an unknown key or bad value throws.
+ */
+void tuning_params::load(const char* path)
+{
+    FILE* fp = fopen(path, "r");
+    if (fp == nullptr)
+        return;
+
+    struct {
+        const char* key;
+        uint32_t*   u32;
+        uint16_t*   u16;
+    } table[] = {
+        { "dataplane.mempool_nseg",      &dataplane_mempool_nseg,   nullptr           },
+        { "dataplane.mp_cachesiz",       &dataplane_mp_cachesiz,    nullptr           },
+        { "dataplane.nb_rxtx_queues",    nullptr,                   &nb_rxtx_queues   },
+        { "dataplane.rx_ring_size",      nullptr,                   &rx_ring_size     },
+        { "dataplane.tx_ring_size",      nullptr,                   &tx_ring_size     },
+        { "dataplane.burst_size",        nullptr,                   &burst_size       },
+        { "dataplane.tx_drain_us",       &tx_drain_us,              nullptr           },
+        { "dataplane.mbuf_bufsiz",       nullptr,                   &mbuf_bufsiz      },
+        { "arp.mempool_nseg",            &arp_mempool_nseg,         nullptr           },
+        { "arp.mp_cachesiz",             &arp_mp_cachesiz,          nullptr           },
+        { "arp.table_size",              &arp_table_size,           nullptr           },
+        { "ip.dir_mempool_nseg",         &ip_dir_mempool_nseg,      nullptr           },
+        { "ip.dir_mp_cachesiz",          &ip_dir_mp_cachesiz,       nullptr           },
+        { "ip.ind_mempool_nseg",         &ip_ind_mempool_nseg,      nullptr           },
+        { "ip.ind_mp_cachesiz",          &ip_ind_mp_cachesiz,       nullptr           },
+        { "ip.frag_nb_buckets",          &ipfrag_nb_buckets,        nullptr           },
+        { "ip.frag_nb_ent_per_bucket",   &ipfrag_nb_ent_per_bucket, nullptr           },
+        { "ip.frag_max_ent_per_bucket",  &ipfrag_max_ent_per_bucket,nullptr           },
+        { "ip.frag_timeout_ms",          &ipfrag_timeout_ms,        nullptr           },
+        { "ip.frag_max_frags",           &ipfrag_max_frags,         nullptr           },
+        { "ip.frag_max_frags_per_src",   &ipfrag_max_frags_per_src, nullptr           },
+        { "ip.fib_max_rules",            &ip_fib_max_rules,         nullptr           },
+        { "ip.fib_nb_tbl8",              &ip_fib_nb_tbl8,           nullptr           },
+        { "tcp.mempool_nseg",            &tcp_mempool_nseg,         nullptr           },
+        { "tcp.mp_cachesiz",             &tcp_mp_cachesiz,          nullptr           },
+        { "tcp.nb_socket_alloc",         &tcp_nb_socket_alloc,      nullptr           },
+        { "tcp.sock_slab",               &tcp_sock_slab,            nullptr           },
+        { "tcp.rto_init_ms",             &tcp_rto_init_ms,          nullptr           },
+        { "tcp.rto_min_ms",              &tcp_rto_min_ms,           nullptr           },
+        { "tcp.rto_max_ms",              &tcp_rto_max_ms,           nullptr           },
+        { "tcp.rtx_max",                 &tcp_rtx_max,              nullptr           },
+        { "tcp.synack_max",              &tcp_synack_max,           nullptr           },
+    };
+
+    std::string section;
+    char buf[256];
+    while (fgets(buf, sizeof buf, fp) != nullptr) {
+        std::string line = buf;
+        size_t c = line.find_first_of("#;");
+        if (c != std::string::npos)
+            line.erase(c);
+        line = strip(line);
+        if (line.empty())
+            continue;
+
+        if (line[0] == '[' && line[line.size()-1] == ']') {
+            section = strip(line.substr(1, line.size()-2));
+            continue;
+        }
+
+        size_t eq = line.find('=');
+        if (eq == std::string::npos) {
+            fclose(fp);
+            std::string errstr = "tuning: syntax error: " + line;
+            throw exception(errstr.c_str());
+        }
+        std::string key = section + "." + strip(line.substr(0, eq));
+        std::string val = strip(line.substr(eq+1));
+
+        bool found = false;
+        for (auto& ent : table) {
+            if (key != ent.key)
+                continue;
+            try {
+                if (ent.u32) set_uint(ent.u32, key, val);
+                else         set_uint(ent.u16, key, val);
+            } catch (...) {
+                fclose(fp);
+                throw;
+            }
+            found = true;
+            break;
+        }
+        if (!found) {
+            fclose(fp);
+            std::string errstr = "tuning: unknown key " + key;
+            throw exception(errstr.c_str());
+        }
+    }
+    fclose(fp);
+
+    if (burst_size < 1 || burst_size > BURST_SIZE)
+        burst_size = BURST_SIZE;
+    if (nb_rxtx_queues < 1)
+        nb_rxtx_queues = 1;
+    if (arp_table_size < 2 || (arp_table_size & (arp_table_size-1)) != 0)
+        throw exception("tuning: arp.table_size must be a power of 2");
+    if (tcp_sock_slab < 1)
+        tcp_sock_slab = 1;
+    if (tcp_rto_min_ms < 1)
+        tcp_rto_min_ms = 1;
+    if (tcp_rto_max_ms < tcp_rto_min_ms)
+        throw exception("tuning: tcp.rto_max_ms must not be below rto_min_ms");
+}
+
+
+} /* namespace stcp */